@@ -172,6 +172,14 @@ static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, TranslationBlock *itb)
     tb_exit = ret & TB_EXIT_MASK;
     trace_exec_tb_exit(last_tb, tb_exit);
 
+    if (unlikely(tb_profile_enabled) && last_tb) {
+        if (tb_exit > TB_EXIT_IDX1) {
+            last_tb->prof.exit_requested++;
+        } else {
+            last_tb->prof.exit_nochain++;
+        }
+    }
+
     if (tb_exit > TB_EXIT_IDX1) {
         /* We didn't start executing this TB (eg because the instruction
          * counter hit zero); we must restore the guest PC to the address
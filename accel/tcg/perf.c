@@ -0,0 +1,232 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * perf-<pid>.map is a text file with one "start size name" line per
+ * translated block; perf report picks it up automatically.  jit-<pid>.dump
+ * follows the jitdump format described in the Linux sources under
+ * tools/perf/Documentation/jitdump-specification.txt.  Unlike the map, it
+ * carries a timestamp for each block, so "perf inject --jit" attributes
+ * samples correctly even after tb_flush reuses the code buffer.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "cpu.h"
+#include "disas/disas.h"
+#include "elf.h"
+#include "exec/perf.h"
+
+static FILE *safe_fopen_w(const char *path)
+{
+    int saved_errno;
+    FILE *f;
+    int fd;
+
+    /* Delete the old file, if any. */
+    unlink(path);
+
+    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
+    fd = open(path, O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    /* Convert fd to FILE*. */
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return f;
+}
+
+static FILE *perfmap;
+
+void perf_enable_perfmap(void)
+{
+    char map_file[32];
+
+    snprintf(map_file, sizeof(map_file), "/tmp/perf-%d.map", getpid());
+    perfmap = safe_fopen_w(map_file);
+    if (perfmap == NULL) {
+        warn_report("Could not open %s: %s, proceeding without perfmap",
+                    map_file, strerror(errno));
+    }
+}
+
+static FILE *jitdump;
+static void *perf_marker = MAP_FAILED;
+static size_t perf_marker_size;
+static uint64_t jitdump_code_index;
+
+#define JITHEADER_MAGIC 0x4A695444
+#define JITHEADER_VERSION 1
+
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+enum jit_record_type {
+    JIT_CODE_LOAD = 0,
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+/* perf needs the ELF machine of the host code, which is the one of the
+ * QEMU binary itself.  */
+static uint32_t get_e_machine(void)
+{
+    Elf64_Ehdr elf_header;
+    FILE *exe;
+    size_t n;
+
+    QEMU_BUILD_BUG_ON(offsetof(Elf32_Ehdr, e_machine) !=
+                      offsetof(Elf64_Ehdr, e_machine));
+
+    exe = fopen("/proc/self/exe", "r");
+    if (exe == NULL) {
+        return EM_NONE;
+    }
+
+    n = fread(&elf_header, sizeof(elf_header), 1, exe);
+    fclose(exe);
+    if (n != 1) {
+        return EM_NONE;
+    }
+
+    return elf_header.e_machine;
+}
+
+void perf_enable_jitdump(void)
+{
+    struct jitheader header;
+    char jitdump_file[32];
+
+    if (!use_rt_clock) {
+        warn_report("CLOCK_MONOTONIC is not available, proceeding without "
+                    "jitdump");
+        return;
+    }
+
+    snprintf(jitdump_file, sizeof(jitdump_file), "jit-%d.dump", getpid());
+    jitdump = safe_fopen_w(jitdump_file);
+    if (jitdump == NULL) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        return;
+    }
+
+    /* perf inject recognizes the jitdump file by looking for an executable
+     * mapping of a file named jit-<pid>.dump in the recorded events.  */
+    perf_marker_size = qemu_real_host_page_size;
+    perf_marker = mmap(NULL, perf_marker_size, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE, fileno(jitdump), 0);
+    if (perf_marker == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        fclose(jitdump);
+        jitdump = NULL;
+        return;
+    }
+
+    header.magic = JITHEADER_MAGIC;
+    header.version = JITHEADER_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = get_e_machine();
+    header.pad1 = 0;
+    header.pid = getpid();
+    header.timestamp = get_clock();
+    header.flags = 0;
+    fwrite(&header, sizeof(header), 1, jitdump);
+}
+
+/* Called with tb_lock held, which serializes the writers.  */
+void perf_report_code(uint64_t guest_pc, const void *start, size_t size)
+{
+    const char *symbol;
+    char *name;
+
+    if (!perfmap && !jitdump) {
+        return;
+    }
+
+    symbol = lookup_symbol(guest_pc);
+    if (symbol[0] != '\0') {
+        name = g_strdup_printf("%s [0x%" PRIx64 "]", symbol, guest_pc);
+    } else {
+        name = g_strdup_printf("guest-0x%" PRIx64, guest_pc);
+    }
+
+    if (perfmap) {
+        fprintf(perfmap, "%" PRIxPTR " %zx %s\n",
+                (uintptr_t)start, size, name);
+    }
+
+    if (jitdump) {
+        struct jr_code_load load;
+        size_t name_len = strlen(name) + 1;
+
+        load.p.id = JIT_CODE_LOAD;
+        load.p.total_size = sizeof(load) + name_len + size;
+        load.p.timestamp = get_clock();
+        load.pid = getpid();
+        load.tid = qemu_get_thread_id();
+        load.vma = (uintptr_t)start;
+        load.code_addr = (uintptr_t)start;
+        load.code_size = size;
+        load.code_index = jitdump_code_index++;
+        fwrite(&load, sizeof(load), 1, jitdump);
+        fwrite(name, name_len, 1, jitdump);
+        fwrite(start, size, 1, jitdump);
+    }
+
+    g_free(name);
+}
+
+void perf_exit(void)
+{
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+
+    if (perf_marker != MAP_FAILED) {
+        munmap(perf_marker, perf_marker_size);
+        perf_marker = MAP_FAILED;
+    }
+
+    if (jitdump) {
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+}
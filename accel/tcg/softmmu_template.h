@@ -315,11 +315,33 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
         index2 = (page2 >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
         tlb_addr2 = env->tlb_table[mmu_idx][index2].addr_write;
         if (page2 != (tlb_addr2 & (TARGET_PAGE_MASK | TLB_INVALID_MASK))
-            && !VICTIM_TLB_HIT(addr_write, page2)) {
+            && !victim_tlb_hit(env, mmu_idx, index2,
+                               offsetof(CPUTLBEntry, addr_write), page2)) {
             tlb_fill(ENV_GET_CPU(env), page2, MMU_DATA_STORE,
                      mmu_idx, retaddr);
         }
 
+        /* If both pages are RAM without any special handling, write the
+           two parts directly rather than one byte at a time.  */
+        tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
+        tlb_addr2 = env->tlb_table[mmu_idx][index2].addr_write;
+        if (tlb_addr == (addr & TARGET_PAGE_MASK) && tlb_addr2 == page2) {
+            uint8_t *haddr1, *haddr2;
+            int n1 = page2 - addr;
+
+            haddr1 = (uint8_t *)(uintptr_t)
+                (addr + env->tlb_table[mmu_idx][index].addend);
+            haddr2 = (uint8_t *)(uintptr_t)
+                (page2 + env->tlb_table[mmu_idx][index2].addend);
+            for (i = 0; i < n1; ++i) {
+                haddr1[i] = val >> (i * 8);
+            }
+            for (; i < DATA_SIZE; ++i) {
+                haddr2[i - n1] = val >> (i * 8);
+            }
+            return;
+        }
+
         /* XXX: not efficient, but simple.  */
         /* This loop must go in the forward direction to avoid issues
            with self-modifying code in Windows 64-bit.  */
@@ -391,11 +413,33 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
         index2 = (page2 >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
         tlb_addr2 = env->tlb_table[mmu_idx][index2].addr_write;
         if (page2 != (tlb_addr2 & (TARGET_PAGE_MASK | TLB_INVALID_MASK))
-            && !VICTIM_TLB_HIT(addr_write, page2)) {
+            && !victim_tlb_hit(env, mmu_idx, index2,
+                               offsetof(CPUTLBEntry, addr_write), page2)) {
             tlb_fill(ENV_GET_CPU(env), page2, MMU_DATA_STORE,
                      mmu_idx, retaddr);
         }
 
+        /* If both pages are RAM without any special handling, write the
+           two parts directly rather than one byte at a time.  */
+        tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
+        tlb_addr2 = env->tlb_table[mmu_idx][index2].addr_write;
+        if (tlb_addr == (addr & TARGET_PAGE_MASK) && tlb_addr2 == page2) {
+            uint8_t *haddr1, *haddr2;
+            int n1 = page2 - addr;
+
+            haddr1 = (uint8_t *)(uintptr_t)
+                (addr + env->tlb_table[mmu_idx][index].addend);
+            haddr2 = (uint8_t *)(uintptr_t)
+                (page2 + env->tlb_table[mmu_idx][index2].addend);
+            for (i = 0; i < n1; ++i) {
+                haddr1[i] = val >> (((DATA_SIZE - 1) * 8) - (i * 8));
+            }
+            for (; i < DATA_SIZE; ++i) {
+                haddr2[i - n1] = val >> (((DATA_SIZE - 1) * 8) - (i * 8));
+            }
+            return;
+        }
+
         /* XXX: not efficient, but simple */
         /* This loop must go in the forward direction to avoid issues
            with self-modifying code.  */
@@ -57,7 +57,9 @@
 #include "qemu/timer.h"
 #include "qemu/main-loop.h"
 #include "exec/log.h"
+#include "exec/perf.h"
 #include "sysemu/cpus.h"
+#include "qapi-types.h"
 
 /* #define DEBUG_TB_INVALIDATE */
 /* #define DEBUG_TB_FLUSH */
@@ -110,6 +112,7 @@ typedef struct PageDesc {
     unsigned int code_write_count;
     unsigned long *code_bitmap;
 #else
+    /* Read without holding mmap_lock, so always use atomic_read/set.  */
     unsigned long flags;
 #endif
 } PageDesc;
@@ -156,6 +159,7 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+bool tb_profile_enabled;
 
 /* translation block context */
 static __thread int have_tb_lock;
@@ -351,7 +355,8 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
     return 0;
 }
 
-bool cpu_restore_state(CPUState *cpu, uintptr_t host_pc)
+static bool cpu_restore_state_1(CPUState *cpu, uintptr_t host_pc,
+                                bool exception)
 {
     TranslationBlock *tb;
     bool r = false;
@@ -377,6 +382,9 @@ bool cpu_restore_state(CPUState *cpu, uintptr_t host_pc)
         tb_lock();
         tb = tb_find_pc(host_pc);
         if (tb) {
+            if (unlikely(tb_profile_enabled) && exception) {
+                tb->prof.exit_restore++;
+            }
             cpu_restore_state_from_tb(cpu, tb, host_pc);
             if (tb->cflags & CF_NOCACHE) {
                 /* one-shot translation, invalidate it immediately */
@@ -391,6 +399,20 @@ bool cpu_restore_state(CPUState *cpu, uintptr_t host_pc)
     return r;
 }
 
+bool cpu_restore_state(CPUState *cpu, uintptr_t host_pc)
+{
+    return cpu_restore_state_1(cpu, host_pc, false);
+}
+
+bool cpu_restore_state_exception(CPUState *cpu, uintptr_t host_pc)
+{
+    /* Internal exit codes (EXCP_ATOMIC, EXCP_DEBUG, ...) are not guest
+     * exceptions and are left out of the TB profile.  */
+    return cpu_restore_state_1(cpu, host_pc,
+                               cpu->exception_index >= 0 &&
+                               cpu->exception_index < EXCP_INTERRUPT);
+}
+
 static void page_init(void)
 {
     page_size_init();
@@ -1190,7 +1212,7 @@ static inline void tb_alloc_page(TranslationBlock *tb,
                 continue;
             }
             prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
+            atomic_set(&p2->flags, p2->flags & ~PAGE_WRITE);
           }
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
@@ -1277,6 +1299,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    memset(&tb->prof, 0, sizeof(tb->prof));
     tcg_ctx->tb_cflags = cflags;
 
 #ifdef CONFIG_PROFILER
@@ -1293,6 +1316,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
     trace_translate_block(tb, tb->pc, tb->tc.ptr);
 
+    if (unlikely(tb_profile_enabled)) {
+        TCGOp *op;
+
+        QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+            if (op->opc == INDEX_op_call) {
+                tb->prof.helpers++;
+            }
+        }
+    }
+
     /* generate machine code */
     tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
     tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
@@ -1365,6 +1398,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 #endif
 
+    perf_report_code(tb->pc, tb->tc.ptr,
+                     tcg_ctx->data_gen_ptr
+                     ? tcg_ctx->data_gen_ptr - tb->tc.ptr : gen_code_size);
+
     atomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
@@ -1929,6 +1966,76 @@ void dump_opcount_info(FILE *f, fprintf_function cpu_fprintf)
     tcg_dump_op_count(f, cpu_fprintf);
 }
 
+static gboolean tb_profile_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    GPtrArray *tbs = data;
+
+    if (tb->prof.exec_count) {
+        g_ptr_array_add(tbs, tb);
+    }
+    return false;
+}
+
+static gint tb_profile_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const TranslationBlock *a = *(const TranslationBlock **)ap;
+    const TranslationBlock *b = *(const TranslationBlock **)bp;
+
+    if (a->prof.exec_count != b->prof.exec_count) {
+        return a->prof.exec_count > b->prof.exec_count ? -1 : 1;
+    }
+    return a->pc < b->pc ? -1 : a->pc > b->pc;
+}
+
+/* Return the @max most executed TBs, hottest first.  Only TBs that are
+ * still in the translation cache are reported, since their counters go
+ * away with them on tb_flush.
+ */
+TBProfileInfoList *tb_profile_query(int64_t max)
+{
+    TBProfileInfoList *head = NULL, **tail = &head;
+    GPtrArray *tbs = g_ptr_array_new();
+    guint i;
+
+    tb_lock();
+
+    g_tree_foreach(tb_ctx.tb_tree, tb_profile_iter, tbs);
+    g_ptr_array_sort(tbs, tb_profile_cmp);
+
+    for (i = 0; i < tbs->len && i < max; i++) {
+        const TranslationBlock *tb = g_ptr_array_index(tbs, i);
+        const struct tb_profile *prof = &tb->prof;
+        TBProfileInfoList *entry = g_new0(TBProfileInfoList, 1);
+        TBProfileInfo *info = g_new0(TBProfileInfo, 1);
+        /* exit_requested counts TBs stopped at the exit request check,
+         * before the entry counter is bumped, so it is not an exit of an
+         * entered TB.  */
+        uint64_t exits = (uint64_t)prof->exit_nochain + prof->exit_restore;
+
+        info->pc = tb->pc;
+        info->size = tb->size;
+        info->insns = tb->icount;
+        info->host_size = tb->tc.size;
+        info->exec_count = prof->exec_count;
+        info->exit_chained = (prof->exec_count > exits
+                              ? prof->exec_count - exits : 0);
+        info->exit_nochain = prof->exit_nochain;
+        info->exit_requested = prof->exit_requested;
+        info->exit_exception = prof->exit_restore;
+        info->helpers = prof->helpers;
+
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    tb_unlock();
+
+    g_ptr_array_free(tbs, true);
+    return head;
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
@@ -2058,7 +2165,37 @@ int page_get_flags(target_ulong address)
     if (!p) {
         return 0;
     }
-    return p->flags;
+    return atomic_read(&p->flags);
+}
+
+/* Return the address of the highest page in [start, end) that has any
+   flags set, or -1 if the whole range is unused.  Does not need the
+   mmap_lock; unallocated leaves of the page table are skipped in one
+   step rather than page by page.  */
+target_ulong page_find_last_used(target_ulong start, target_ulong end)
+{
+    tb_page_addr_t first = start >> TARGET_PAGE_BITS;
+    tb_page_addr_t index = TARGET_PAGE_ALIGN(end) >> TARGET_PAGE_BITS;
+
+    while (index > first) {
+        tb_page_addr_t base = (index - 1) & ~(tb_page_addr_t)(V_L2_SIZE - 1);
+        PageDesc *p = page_find(index - 1);
+
+        if (base < first) {
+            base = first;
+        }
+        if (p) {
+            /* P points at page INDEX - 1; walk down within its leaf.  */
+            p -= (index - 1) & (V_L2_SIZE - 1);
+            for (; index > base; index--) {
+                if (atomic_read(&p[(index - 1) & (V_L2_SIZE - 1)].flags)) {
+                    return (target_ulong)(index - 1) << TARGET_PAGE_BITS;
+                }
+            }
+        }
+        index = base;
+    }
+    return -1;
 }
 
 /* Modify the flags of a page and invalidate the code if necessary.
@@ -2096,15 +2233,16 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
             p->first_tb) {
             tb_invalidate_phys_page(addr, 0);
         }
-        p->flags = flags;
+        atomic_set(&p->flags, flags);
     }
 }
 
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    PageDesc *p;
+    PageDesc *p = NULL;
     target_ulong end;
     target_ulong addr;
+    unsigned long pflags;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -2128,24 +2266,32 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     for (addr = start, len = end - start;
          len != 0;
          len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
+        /* Only walk the page table when entering a new leaf; within
+           a leaf the descriptors are contiguous.  Leaves are never
+           freed, so this needs no lock.  */
+        if (p == NULL || ((addr >> TARGET_PAGE_BITS) & (V_L2_SIZE - 1)) == 0) {
+            p = page_find(addr >> TARGET_PAGE_BITS);
+            if (!p) {
+                return -1;
+            }
+        } else {
+            p++;
         }
-        if (!(p->flags & PAGE_VALID)) {
+        pflags = atomic_read(&p->flags);
+        if (!(pflags & PAGE_VALID)) {
             return -1;
         }
 
-        if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
+        if ((flags & PAGE_READ) && !(pflags & PAGE_READ)) {
             return -1;
         }
         if (flags & PAGE_WRITE) {
-            if (!(p->flags & PAGE_WRITE_ORG)) {
+            if (!(pflags & PAGE_WRITE_ORG)) {
                 return -1;
             }
             /* unprotect the page if it was put read-only because it
                contains translated code */
-            if (!(p->flags & PAGE_WRITE)) {
+            if (!(pflags & PAGE_WRITE)) {
                 if (!page_unprotect(addr, 0)) {
                     return -1;
                 }
@@ -2189,7 +2335,7 @@ int page_unprotect(target_ulong address, uintptr_t pc)
         current_tb_invalidated = false;
         for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
             p = page_find(addr >> TARGET_PAGE_BITS);
-            p->flags |= PAGE_WRITE;
+            atomic_set(&p->flags, p->flags | PAGE_WRITE);
             prot |= p->flags;
 
             /* and since the content will be modified, we must invalidate
@@ -609,6 +609,46 @@ int cpu_signal_handler(int host_signum, void *pinfo,
 
 #endif
 
+void *probe_access(CPUArchState *env, target_ulong addr, int size,
+                   MMUAccessType access_type, int mmu_idx,
+                   uintptr_t retaddr)
+{
+    int flags;
+
+    switch (access_type) {
+    case MMU_DATA_LOAD:
+        flags = PAGE_READ;
+        break;
+    case MMU_DATA_STORE:
+        flags = PAGE_WRITE;
+        break;
+    case MMU_INST_FETCH:
+        flags = PAGE_EXEC;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    /* A page that was made read-only because it contains translated
+       code is unprotected here rather than by page_check_range(), so
+       that the TB being executed can be exited if it was modified.  */
+    if (access_type == MMU_DATA_STORE) {
+        int pflags = page_get_flags(addr);
+
+        if ((pflags & PAGE_WRITE_ORG) && !(pflags & PAGE_WRITE) &&
+            page_unprotect(addr, retaddr) == 2) {
+            cpu_loop_exit_noexc(ENV_GET_CPU(env));
+        }
+    }
+
+    /* Let the caller's slow path raise the fault on an inaccessible
+       page, since there is no TLB to fill here.  */
+    if (page_check_range(addr, size, flags) < 0) {
+        return NULL;
+    }
+    return g2h(addr);
+}
+
 /* The softmmu versions of these helpers are in cputlb.c.  */
 
 /* Do not allow unaligned operations to proceed.  Return the host address.  */
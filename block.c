@@ -775,6 +775,28 @@ int bdrv_parse_discard_flags(const char *mode, int *flags)
     return 0;
 }
 
+/**
+ * Set open flags for a given AIO mode
+ *
+ * Return 0 on success, -1 if the AIO mode was invalid.
+ */
+int bdrv_parse_aio(const char *mode, int *flags)
+{
+    *flags &= ~(BDRV_O_NATIVE_AIO | BDRV_O_IO_URING);
+
+    if (!strcmp(mode, "threads")) {
+        /* this is the default */
+    } else if (!strcmp(mode, "native")) {
+        *flags |= BDRV_O_NATIVE_AIO;
+    } else if (!strcmp(mode, "io_uring")) {
+        *flags |= BDRV_O_IO_URING;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * Set open flags for a given cache mode
  *
@@ -859,8 +881,9 @@ static void bdrv_temp_snapshot_options(int *child_flags, QDict *child_options,
     qdict_copy_default(child_options, parent_options, BDRV_OPT_READ_ONLY);
 
     /* aio=native doesn't work for cache.direct=off, so disable it for the
-     * temporary snapshot */
-    *child_flags &= ~BDRV_O_NATIVE_AIO;
+     * temporary snapshot.  Use the default thread pool there for io_uring
+     * as well. */
+    *child_flags &= ~(BDRV_O_NATIVE_AIO | BDRV_O_IO_URING);
 }
 
 /*
@@ -1278,6 +1301,18 @@ QemuOptsList bdrv_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "always accept other writers (default: off)",
         },
+        {
+            .name = BDRV_OPT_CHAIN_CACHE,
+            .type = QEMU_OPT_BOOL,
+            .help = "cache which backing layer owns recently read ranges "
+                    "(default: off)",
+        },
+        {
+            .name = BDRV_OPT_CHAIN_CACHE_COR_THRESHOLD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "copy ranges into the image after this many reads from "
+                    "a backing layer (default: 0, never)",
+        },
         { /* end of list */ }
     },
 };
@@ -1409,6 +1444,30 @@ static int bdrv_open_common(BlockDriverState *bs, BlockBackend *file,
         bs->detect_zeroes = value;
     }
 
+    if (qemu_opt_get_bool(opts, BDRV_OPT_CHAIN_CACHE, false)) {
+        uint64_t cor_threshold =
+            qemu_opt_get_number(opts, BDRV_OPT_CHAIN_CACHE_COR_THRESHOLD, 0);
+
+        if (cor_threshold > UINT_MAX) {
+            error_setg(errp, BDRV_OPT_CHAIN_CACHE_COR_THRESHOLD
+                       " must be at most %u", UINT_MAX);
+            ret = -EINVAL;
+            goto fail_opts;
+        }
+        if (cor_threshold && bs->read_only) {
+            error_setg(errp, BDRV_OPT_CHAIN_CACHE_COR_THRESHOLD
+                       " cannot be used on read-only images");
+            ret = -EINVAL;
+            goto fail_opts;
+        }
+        bdrv_chain_cache_enable(bs, cor_threshold);
+    } else if (qemu_opt_get(opts, BDRV_OPT_CHAIN_CACHE_COR_THRESHOLD)) {
+        error_setg(errp, BDRV_OPT_CHAIN_CACHE_COR_THRESHOLD " requires "
+                   BDRV_OPT_CHAIN_CACHE "=on");
+        ret = -EINVAL;
+        goto fail_opts;
+    }
+
     if (filename != NULL) {
         pstrcpy(bs->filename, sizeof(bs->filename), filename);
     } else {
@@ -1423,6 +1482,7 @@ static int bdrv_open_common(BlockDriverState *bs, BlockBackend *file,
     assert(!drv->bdrv_file_open || file == NULL);
     ret = bdrv_open_driver(bs, drv, node_name, options, open_flags, errp);
     if (ret < 0) {
+        bdrv_chain_cache_free(bs);
         goto fail_opts;
     }
 
@@ -1997,6 +2057,9 @@ static void bdrv_replace_child_noperm(BdrvChild *child,
     if (old_bs && new_bs) {
         assert(bdrv_get_aio_context(old_bs) == bdrv_get_aio_context(new_bs));
     }
+    if (child->role == &child_backing && old_bs != new_bs) {
+        bdrv_chain_cache_invalidate_all(child->opaque);
+    }
     if (old_bs) {
         /* Detach first so that the recursive drain sections coming from @child
          * are already gone and we only end the drain sections that came from
@@ -3275,6 +3338,7 @@ static void bdrv_close(BlockDriverState *bs)
     g_free(bs->opaque);
     bs->opaque = NULL;
     atomic_set(&bs->copy_on_read, 0);
+    bdrv_chain_cache_free(bs);
     bs->backing_file[0] = '\0';
     bs->backing_format[0] = '\0';
     bs->total_sectors = 0;
@@ -3660,6 +3724,7 @@ int bdrv_truncate(BdrvChild *child, int64_t offset, PreallocMode prealloc,
     }
     bdrv_dirty_bitmap_truncate(bs, offset);
     bdrv_parent_cb_resize(bs);
+    bdrv_chain_cache_invalidate_all(bs);
     atomic_inc(&bs->write_gen);
     return ret;
 }
@@ -4269,6 +4334,9 @@ void bdrv_invalidate_cache(BlockDriverState *bs, Error **errp)
         }
     }
 
+    /* Another process may have written the image while it was inactive */
+    bdrv_chain_cache_invalidate_all(bs);
+
     ret = refresh_total_sectors(bs, bs->total_sectors);
     if (ret < 0) {
         bs->open_flags |= BDRV_O_INACTIVE;
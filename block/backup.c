@@ -27,6 +27,10 @@
 #include "qemu/error-report.h"
 
 #define BACKUP_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BACKUP_MAX_WORKERS 256
+#define BACKUP_MAX_CHUNK (64 * 1024 * 1024)
+/* Each worker may hold a bounce buffer of max_chunk bytes */
+#define BACKUP_MAX_BUFFERS (256 * 1024 * 1024)
 #define SLICE_TIME 100000000ULL /* ns */
 
 typedef struct BackupBlockJob {
@@ -42,12 +46,34 @@ typedef struct BackupBlockJob {
     uint64_t bytes_read;
     int64_t cluster_size;
     bool compress;
+    /* Try blk_co_copy_range() for copies done by the job itself */
+    bool use_copy_range;
     NotifierWithReturn before_write;
     QLIST_HEAD(, CowRequest) inflight_reqs;
 
     HBitmap *copy_bitmap;
+
+    /* Contiguous dirty clusters are copied together, up to this size */
+    int64_t max_chunk;
+
+    /* Copies of the job itself run in up to max_workers coroutines */
+    int max_workers;
+    int in_flight;
+    bool waiting_for_worker;
+
+    /* First error of a worker since the job last looked; failed copies set
+     * their clusters in copy_bitmap again, none before worker_error_offset. */
+    int worker_ret;
+    bool worker_error_is_read;
+    int64_t worker_error_offset;
 } BackupBlockJob;
 
+typedef struct BackupTask {
+    BackupBlockJob *job;
+    int64_t offset;
+    int64_t bytes;
+} BackupTask;
+
 /* See if in-flight requests overlap and wait for them to complete */
 static void coroutine_fn wait_for_overlapping_requests(BackupBlockJob *job,
                                                        int64_t start,
@@ -85,6 +111,51 @@ static void cow_request_end(CowRequest *req)
     qemu_co_queue_restart_all(&req->wait_queue);
 }
 
+/* Copy @n bytes at @start to the target by reading them into a buffer */
+static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
+                                                      int64_t start, int n,
+                                                      bool is_write_notifier,
+                                                      bool *error_is_read,
+                                                      void *bounce_buffer)
+{
+    BlockBackend *blk = job->common.blk;
+    struct iovec iov;
+    QEMUIOVector bounce_qiov;
+    int ret;
+
+    iov.iov_base = bounce_buffer;
+    iov.iov_len = n;
+    qemu_iovec_init_external(&bounce_qiov, &iov, 1);
+
+    ret = blk_co_preadv(blk, start, bounce_qiov.size, &bounce_qiov,
+                        is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0);
+    if (ret < 0) {
+        trace_backup_do_cow_read_fail(job, start, ret);
+        if (error_is_read) {
+            *error_is_read = true;
+        }
+        return ret;
+    }
+
+    if (buffer_is_zero(iov.iov_base, iov.iov_len)) {
+        ret = blk_co_pwrite_zeroes(job->target, start,
+                                   bounce_qiov.size, BDRV_REQ_MAY_UNMAP);
+    } else {
+        ret = blk_co_pwritev(job->target, start,
+                             bounce_qiov.size, &bounce_qiov,
+                             job->compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
+    }
+    if (ret < 0) {
+        trace_backup_do_cow_write_fail(job, start, ret);
+        if (error_is_read) {
+            *error_is_read = false;
+        }
+        return ret;
+    }
+
+    return 0;
+}
+
 static int coroutine_fn backup_do_cow(BackupBlockJob *job,
                                       int64_t offset, uint64_t bytes,
                                       bool *error_is_read,
@@ -92,11 +163,10 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
 {
     BlockBackend *blk = job->common.blk;
     CowRequest cow_request;
-    struct iovec iov;
-    QEMUIOVector bounce_qiov;
     void *bounce_buffer = NULL;
     int ret = 0;
     int64_t start, end; /* bytes */
+    int64_t cluster, nr_clusters, dirty_end;
     int n; /* bytes */
 
     qemu_co_rwlock_rdlock(&job->flush_rwlock);
@@ -109,49 +179,55 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
     wait_for_overlapping_requests(job, start, end);
     cow_request_begin(&cow_request, job, start, end);
 
-    for (; start < end; start += job->cluster_size) {
-        if (!hbitmap_get(job->copy_bitmap, start / job->cluster_size)) {
+    for (; start < end; start += nr_clusters * job->cluster_size) {
+        cluster = start / job->cluster_size;
+        if (!hbitmap_get(job->copy_bitmap, cluster)) {
             trace_backup_do_cow_skip(job, start);
+            nr_clusters = 1;
             continue; /* already copied */
         }
-        hbitmap_reset(job->copy_bitmap, start / job->cluster_size, 1);
 
-        trace_backup_do_cow_process(job, start);
-
-        n = MIN(job->cluster_size, job->common.len - start);
-
-        if (!bounce_buffer) {
-            bounce_buffer = blk_blockalign(blk, job->cluster_size);
+        /* Copy the following dirty clusters along with this one */
+        dirty_end = hbitmap_next_zero(job->copy_bitmap, cluster);
+        if (dirty_end == -1) {
+            dirty_end = end;
+        } else {
+            dirty_end = MIN(dirty_end * job->cluster_size, end);
         }
-        iov.iov_base = bounce_buffer;
-        iov.iov_len = n;
-        qemu_iovec_init_external(&bounce_qiov, &iov, 1);
+        n = MIN(MIN(dirty_end - start, job->max_chunk),
+                job->common.len - start);
+        nr_clusters = DIV_ROUND_UP(n, job->cluster_size);
+        hbitmap_reset(job->copy_bitmap, cluster, nr_clusters);
 
-        ret = blk_co_preadv(blk, start, bounce_qiov.size, &bounce_qiov,
-                            is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0);
-        if (ret < 0) {
-            trace_backup_do_cow_read_fail(job, start, ret);
-            if (error_is_read) {
-                *error_is_read = true;
+        trace_backup_do_cow_process(job, start);
+
+        /* Copies from the write notifier must not wait for serialising
+         * requests, which copy_range cannot avoid; use the buffer there. */
+        ret = -ENOTSUP;
+        if (job->use_copy_range && !is_write_notifier) {
+            ret = blk_co_copy_range(blk, start, job->target, start, n, 0);
+            if (ret == -ENOTSUP) {
+                job->use_copy_range = false;
+            } else if (ret < 0) {
+                /* It is not known which side failed */
+                trace_backup_do_cow_copy_range_fail(job, start, ret);
+                if (error_is_read) {
+                    *error_is_read = false;
+                }
             }
-            hbitmap_set(job->copy_bitmap, start / job->cluster_size, 1);
-            goto out;
         }
-
-        if (buffer_is_zero(iov.iov_base, iov.iov_len)) {
-            ret = blk_co_pwrite_zeroes(job->target, start,
-                                       bounce_qiov.size, BDRV_REQ_MAY_UNMAP);
-        } else {
-            ret = blk_co_pwritev(job->target, start,
-                                 bounce_qiov.size, &bounce_qiov,
-                                 job->compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
+        if (ret == -ENOTSUP) {
+            if (!bounce_buffer) {
+                /* No later copy of this request is larger than that */
+                bounce_buffer = blk_blockalign(blk, MIN(end - start,
+                                                        job->max_chunk));
+            }
+            ret = backup_cow_with_bounce_buffer(job, start, n,
+                                                is_write_notifier,
+                                                error_is_read, bounce_buffer);
         }
         if (ret < 0) {
-            trace_backup_do_cow_write_fail(job, start, ret);
-            if (error_is_read) {
-                *error_is_read = false;
-            }
-            hbitmap_set(job->copy_bitmap, start / job->cluster_size, 1);
+            hbitmap_set(job->copy_bitmap, cluster, nr_clusters);
             goto out;
         }
 
@@ -360,30 +436,174 @@ static bool coroutine_fn yield_and_check(BackupBlockJob *job)
     return false;
 }
 
-static int coroutine_fn backup_run_incremental(BackupBlockJob *job)
+static void coroutine_fn backup_wait_for_worker(BackupBlockJob *job)
 {
-    int ret;
+    assert(!job->waiting_for_worker);
+    job->waiting_for_worker = true;
+    qemu_coroutine_yield();
+    job->waiting_for_worker = false;
+}
+
+static void coroutine_fn backup_wait_for_workers(BackupBlockJob *job)
+{
+    while (job->in_flight > 0) {
+        backup_wait_for_worker(job);
+    }
+}
+
+static void backup_worker_error(BackupBlockJob *job, int64_t offset,
+                                int ret, bool error_is_read)
+{
+    if (!job->worker_ret) {
+        job->worker_ret = ret;
+        job->worker_error_is_read = error_is_read;
+        job->worker_error_offset = offset;
+    } else {
+        job->worker_error_offset = MIN(job->worker_error_offset, offset);
+    }
+}
+
+static void coroutine_fn backup_worker_entry(void *opaque)
+{
+    BackupTask *task = opaque;
+    BackupBlockJob *job = task->job;
     bool error_is_read;
-    int64_t cluster;
+    int ret;
+
+    ret = backup_do_cow(job, task->offset, task->bytes, &error_is_read, false);
+    if (ret < 0) {
+        backup_worker_error(job, task->offset, ret, error_is_read);
+    }
+    g_free(task);
+
+    job->in_flight--;
+    if (job->waiting_for_worker) {
+        qemu_coroutine_enter(job->common.co);
+    }
+}
+
+/* Copy @bytes at @offset in a new coroutine, once a worker is available.
+ * With more than one worker, reading the next chunks from the source
+ * overlaps with writing the previous ones to the target. */
+static void coroutine_fn backup_start_worker(BackupBlockJob *job,
+                                             int64_t offset, int64_t bytes)
+{
+    BackupTask *task;
+    Coroutine *co;
+
+    while (job->in_flight >= job->max_workers) {
+        backup_wait_for_worker(job);
+    }
+
+    task = g_new(BackupTask, 1);
+    *task = (BackupTask) {
+        .job    = job,
+        .offset = offset,
+        .bytes  = bytes,
+    };
+    job->in_flight++;
+    co = qemu_coroutine_create(backup_worker_entry, task);
+    qemu_coroutine_enter(co);
+}
+
+/* Apply the error action for a failed worker, if any.  Returns the error if
+ * the job must fail, or sets *@next_cluster to where copying must resume. */
+static int coroutine_fn backup_handle_worker_error(BackupBlockJob *job,
+                                                   int64_t *next_cluster)
+{
+    int ret = job->worker_ret;
+
+    if (!ret) {
+        return 0;
+    }
+
+    /* Let the other workers finish so that all failed clusters are known */
+    backup_wait_for_workers(job);
+    job->worker_ret = 0;
+
+    if (backup_error_action(job, job->worker_error_is_read, -ret) ==
+        BLOCK_ERROR_ACTION_REPORT) {
+        return ret;
+    }
+    *next_cluster = MIN(*next_cluster,
+                        job->worker_error_offset / job->cluster_size);
+    return 0;
+}
+
+/* Copy the clusters set in copy_bitmap (only those allocated in the topmost
+ * image for sync=top), in chunks of up to max_chunk contiguous bytes. */
+static int coroutine_fn backup_loop(BackupBlockJob *job)
+{
+    BlockDriverState *bs = blk_bs(job->common.blk);
+    int64_t nb_clusters = DIV_ROUND_UP(job->common.len, job->cluster_size);
+    int64_t chunk_clusters = job->max_chunk / job->cluster_size;
+    int64_t next_cluster = 0;
+    int64_t cluster, end;
     HBitmapIter hbi;
+    int ret = 0;
+
+    while (true) {
+        ret = backup_handle_worker_error(job, &next_cluster);
+        if (ret < 0) {
+            break;
+        }
+
+        cluster = -1;
+        if (next_cluster < nb_clusters) {
+            hbitmap_iter_init(&hbi, job->copy_bitmap, next_cluster);
+            cluster = hbitmap_iter_next(&hbi);
+        }
+        if (cluster == -1) {
+            if (!job->in_flight) {
+                break;
+            }
+            /* Failed copies set their clusters again, so look once more */
+            backup_wait_for_workers(job);
+            next_cluster = nb_clusters;
+            continue;
+        }
+
+        if (yield_and_check(job)) {
+            break;
+        }
+
+        end = hbitmap_next_zero(job->copy_bitmap, cluster);
+        if (end == -1) {
+            end = nb_clusters;
+        }
+        end = MIN(end, cluster + chunk_clusters);
 
-    hbitmap_iter_init(&hbi, job->copy_bitmap, 0);
-    while ((cluster = hbitmap_iter_next(&hbi)) != -1) {
-        do {
-            if (yield_and_check(job)) {
-                return 0;
+        if (job->sync_mode == MIRROR_SYNC_MODE_TOP) {
+            int64_t offset = cluster * job->cluster_size;
+            int64_t n;
+            int alloced;
+
+            alloced = bdrv_is_allocated(bs, offset,
+                                        MIN(end * job->cluster_size,
+                                            job->common.len) - offset, &n);
+            if (alloced < 0) {
+                backup_worker_error(job, offset, alloced, true);
+                next_cluster = cluster;
+                continue;
             }
-            ret = backup_do_cow(job, cluster * job->cluster_size,
-                                job->cluster_size, &error_is_read, false);
-            if (ret < 0 && backup_error_action(job, error_is_read, -ret) ==
-                           BLOCK_ERROR_ACTION_REPORT)
-            {
-                return ret;
+            if (!alloced && n >= job->cluster_size) {
+                /* Whole clusters only in the backing file, skip them */
+                next_cluster = cluster + n / job->cluster_size;
+                continue;
             }
-        } while (ret < 0);
+            /* Copy partially allocated clusters as a whole; we end up copying
+             * more than needed but at some point that is always the case. */
+            end = MIN(end, cluster + MAX(DIV_ROUND_UP(n, job->cluster_size),
+                                         1));
+        }
+
+        backup_start_worker(job, cluster * job->cluster_size,
+                            (end - cluster) * job->cluster_size);
+        next_cluster = end;
     }
 
-    return 0;
+    backup_wait_for_workers(job);
+    return ret;
 }
 
 /* init copy_bitmap from sync_bitmap */
@@ -431,7 +651,7 @@ static void coroutine_fn backup_run(void *opaque)
     BackupBlockJob *job = opaque;
     BackupCompleteData *data;
     BlockDriverState *bs = blk_bs(job->common.blk);
-    int64_t offset, nb_clusters;
+    int64_t nb_clusters;
     int ret = 0;
 
     QLIST_INIT(&job->inflight_reqs);
@@ -457,68 +677,9 @@ static void coroutine_fn backup_run(void *opaque)
              * notify callback service CoW requests. */
             block_job_yield(&job->common);
         }
-    } else if (job->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
-        ret = backup_run_incremental(job);
     } else {
-        /* Both FULL and TOP SYNC_MODE's require copying.. */
-        for (offset = 0; offset < job->common.len;
-             offset += job->cluster_size) {
-            bool error_is_read;
-            int alloced = 0;
-
-            if (yield_and_check(job)) {
-                break;
-            }
-
-            if (job->sync_mode == MIRROR_SYNC_MODE_TOP) {
-                int i;
-                int64_t n;
-
-                /* Check to see if these blocks are already in the
-                 * backing file. */
-
-                for (i = 0; i < job->cluster_size;) {
-                    /* bdrv_is_allocated() only returns true/false based
-                     * on the first set of sectors it comes across that
-                     * are are all in the same state.
-                     * For that reason we must verify each sector in the
-                     * backup cluster length.  We end up copying more than
-                     * needed but at some point that is always the case. */
-                    alloced =
-                        bdrv_is_allocated(bs, offset + i,
-                                          job->cluster_size - i, &n);
-                    i += n;
-
-                    if (alloced || n == 0) {
-                        break;
-                    }
-                }
-
-                /* If the above loop never found any sectors that are in
-                 * the topmost image, skip this backup. */
-                if (alloced == 0) {
-                    continue;
-                }
-            }
-            /* FULL sync mode we copy the whole drive. */
-            if (alloced < 0) {
-                ret = alloced;
-            } else {
-                ret = backup_do_cow(job, offset, job->cluster_size,
-                                    &error_is_read, false);
-            }
-            if (ret < 0) {
-                /* Depending on error action, fail now or retry cluster */
-                BlockErrorAction action =
-                    backup_error_action(job, error_is_read, -ret);
-                if (action == BLOCK_ERROR_ACTION_REPORT) {
-                    break;
-                } else {
-                    offset -= job->cluster_size;
-                    continue;
-                }
-            }
-        }
+        /* FULL, TOP and INCREMENTAL copy what is set in copy_bitmap */
+        ret = backup_loop(job);
     }
 
     notifier_with_return_remove(&job->before_write);
@@ -548,7 +709,7 @@ static const BlockJobDriver backup_job_driver = {
 BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, int64_t speed,
                   MirrorSyncMode sync_mode, BdrvDirtyBitmap *sync_bitmap,
-                  bool compress,
+                  bool compress, int64_t max_workers, int64_t max_chunk,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   int creation_flags,
@@ -580,6 +741,23 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         return NULL;
     }
 
+    if (max_workers < 1 || max_workers > BACKUP_MAX_WORKERS) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-workers",
+                   "a value in range [1, 256]");
+        return NULL;
+    }
+
+    if (max_chunk < 0 || max_chunk > BACKUP_MAX_CHUNK) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-chunk",
+                   "a value in range [0, 64MB]");
+        return NULL;
+    }
+
+    if (max_workers * max_chunk > BACKUP_MAX_BUFFERS) {
+        error_setg(errp, "max-workers * max-chunk must not exceed 256MB");
+        return NULL;
+    }
+
     if (compress && target->drv->bdrv_co_pwritev_compressed == NULL) {
         error_setg(errp, "Compression is not supported for this drive %s",
                    bdrv_get_device_name(target));
@@ -645,6 +823,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->sync_bitmap = sync_mode == MIRROR_SYNC_MODE_INCREMENTAL ?
                        sync_bitmap : NULL;
     job->compress = compress;
+    job->use_copy_range = !compress;
 
     /* If there is no backing file on the target, we cannot rely on COW if our
      * backup cluster size is smaller than the target cluster size. Even for
@@ -673,6 +852,16 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         job->cluster_size = MAX(BACKUP_CLUSTER_SIZE_DEFAULT, bdi.cluster_size);
     }
 
+    /* Compressed writes are done one cluster at a time */
+    if (compress || max_chunk < job->cluster_size) {
+        job->max_chunk = job->cluster_size;
+    } else {
+        job->max_chunk = QEMU_ALIGN_DOWN(max_chunk, job->cluster_size);
+    }
+    /* Rounding up to large clusters must not lift the memory bound either */
+    job->max_workers = MIN(max_workers,
+                           MAX(BACKUP_MAX_BUFFERS / job->max_chunk, 1));
+
     /* Required permissions are already taken with target's blk_new() */
     block_job_add_bdrv(&job->common, "target", target, 0, BLK_PERM_ALL,
                        &error_abort);
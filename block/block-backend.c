@@ -1879,6 +1879,43 @@ int coroutine_fn blk_co_pwrite_zeroes(BlockBackend *blk, int64_t offset,
                           flags | BDRV_REQ_ZERO_WRITE);
 }
 
+int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
+                                   BlockBackend *blk_out, int64_t off_out,
+                                   int bytes, BdrvRequestFlags flags)
+{
+    int r;
+
+    r = blk_check_byte_request(blk_in, off_in, bytes);
+    if (r) {
+        return r;
+    }
+    r = blk_check_byte_request(blk_out, off_out, bytes);
+    if (r) {
+        return r;
+    }
+
+    bdrv_inc_in_flight(blk_bs(blk_in));
+    bdrv_inc_in_flight(blk_bs(blk_out));
+
+    /* throttling disk I/O, as a read from blk_in and a write to blk_out */
+    if (blk_in->public.throttle_group_member.throttle_state) {
+        throttle_group_co_io_limits_intercept(
+                &blk_in->public.throttle_group_member, bytes, false);
+    }
+    if (blk_out->public.throttle_group_member.throttle_state) {
+        throttle_group_co_io_limits_intercept(
+                &blk_out->public.throttle_group_member, bytes, true);
+    }
+
+    r = bdrv_co_copy_range(blk_in->root, off_in,
+                           blk_out->root, off_out,
+                           bytes, flags);
+
+    bdrv_dec_in_flight(blk_bs(blk_out));
+    bdrv_dec_in_flight(blk_bs(blk_in));
+    return r;
+}
+
 int blk_pwrite_compressed(BlockBackend *blk, int64_t offset, const void *buf,
                           int count)
 {
@@ -0,0 +1,297 @@
+/*
+ * Backing chain allocation cache
+ *
+ * Reading a range that is unallocated in a node goes down its backing chain
+ * one layer at a time, and every layer looks up its own metadata before
+ * deferring to the next one.  On deep snapshot chains this makes each such
+ * read cost one metadata lookup per layer.
+ *
+ * The cache remembers, for recently read ranges, which layer of the chain
+ * owns the data, so that bdrv_aligned_preadv() can send the request straight
+ * to that layer.  Entries are dropped when the range is written in the node
+ * or any layer below it, and all of them when the chain itself changes.
+ *
+ * Optionally, ranges that keep being read from a backing layer are copied
+ * into the node (copy-on-read), so that later reads do not leave the top
+ * layer at all.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+/* The disk is divided into chunks, each of which maps to one cache slot.  A
+ * slot describes a single extent inside its chunk.
+ */
+#define CHAIN_CACHE_CHUNK_BITS  20
+#define CHAIN_CACHE_CHUNK_SIZE  (1LL << CHAIN_CACHE_CHUNK_BITS)
+#define CHAIN_CACHE_SLOTS       4096
+
+/* Requests spanning more chunks than this are not worth a lookup */
+#define CHAIN_CACHE_MAX_CHUNKS  16
+
+typedef struct BdrvChainCacheEntry {
+    int64_t offset;
+    int64_t bytes;      /* 0 if the slot is unused */
+    int depth;          /* Layer that owns the extent, 0 is the node itself */
+    unsigned hits;      /* Reads served from a backing layer, including
+                         * the one that filled the entry */
+} BdrvChainCacheEntry;
+
+struct BdrvChainCache {
+    /* Protects everything below; never held across a yield */
+    QemuMutex lock;
+
+    /* Incremented by every invalidation, so that a lookup that yielded
+     * while querying the chain can tell its result may be stale.
+     */
+    uint64_t gen;
+    unsigned cor_threshold;
+    BdrvChainCacheEntry entries[CHAIN_CACHE_SLOTS];
+};
+
+void bdrv_chain_cache_enable(BlockDriverState *bs, unsigned cor_threshold)
+{
+    BdrvChainCache *cache;
+
+    assert(!bs->chain_cache);
+    cache = g_new0(BdrvChainCache, 1);
+    qemu_mutex_init(&cache->lock);
+    cache->cor_threshold = cor_threshold;
+    bs->chain_cache = cache;
+}
+
+void bdrv_chain_cache_free(BlockDriverState *bs)
+{
+    BdrvChainCache *cache = bs->chain_cache;
+
+    if (cache) {
+        qemu_mutex_destroy(&cache->lock);
+        g_free(cache);
+        bs->chain_cache = NULL;
+    }
+}
+
+static BdrvChainCacheEntry *chain_cache_slot(BdrvChainCache *cache,
+                                             int64_t offset)
+{
+    return &cache->entries[(offset >> CHAIN_CACHE_CHUNK_BITS) %
+                           CHAIN_CACHE_SLOTS];
+}
+
+static void chain_cache_invalidate_one(BdrvChainCache *cache,
+                                       int64_t offset, int64_t bytes)
+{
+    int64_t chunk, first, last;
+
+    qemu_mutex_lock(&cache->lock);
+    cache->gen++;
+    first = offset >> CHAIN_CACHE_CHUNK_BITS;
+    last = (offset + bytes - 1) >> CHAIN_CACHE_CHUNK_BITS;
+    if (bytes <= 0 || last - first >= CHAIN_CACHE_SLOTS) {
+        memset(cache->entries, 0, sizeof(cache->entries));
+    } else {
+        for (chunk = first; chunk <= last; chunk++) {
+            BdrvChainCacheEntry *e =
+                chain_cache_slot(cache, chunk << CHAIN_CACHE_CHUNK_BITS);
+            if (e->bytes && e->offset < offset + bytes &&
+                offset < e->offset + e->bytes) {
+                e->bytes = 0;
+            }
+        }
+    }
+    qemu_mutex_unlock(&cache->lock);
+}
+
+/* A non-positive @bytes drops every entry.  Walks up the graph because a
+ * change in a backing layer changes what the layers above it read.
+ */
+static void chain_cache_invalidate(BlockDriverState *bs,
+                                   int64_t offset, int64_t bytes)
+{
+    BdrvChild *c;
+
+    if (bs->chain_cache) {
+        trace_bdrv_chain_cache_invalidate(bs, offset, bytes);
+        chain_cache_invalidate_one(bs->chain_cache, offset, bytes);
+    }
+    QLIST_FOREACH(c, &bs->parents, next_parent) {
+        if (c->role == &child_backing) {
+            chain_cache_invalidate(c->opaque, offset, bytes);
+        }
+    }
+}
+
+void bdrv_chain_cache_invalidate(BlockDriverState *bs,
+                                 int64_t offset, int64_t bytes)
+{
+    if (bytes > 0) {
+        chain_cache_invalidate(bs, offset, bytes);
+    }
+}
+
+void bdrv_chain_cache_invalidate_all(BlockDriverState *bs)
+{
+    chain_cache_invalidate(bs, 0, 0);
+}
+
+/* Find the layer that owns the data at @offset and how far that extends,
+ * up to @bytes.  This is what bdrv_is_allocated_above() does, except that
+ * it also reports the depth of the owning layer.
+ */
+static int coroutine_fn chain_cache_query(BlockDriverState *bs,
+                                          int64_t offset, int64_t bytes,
+                                          int *depth, int64_t *pnum)
+{
+    BlockDriverState *layer = bs;
+    int d = 0;
+
+    while (true) {
+        BlockDriverState *next = backing_bs(layer);
+        int64_t count;
+        int ret;
+
+        ret = bdrv_is_allocated(layer, offset, bytes, &count);
+        if (ret < 0) {
+            return ret;
+        }
+        /* Past the end of this layer: it reads as zeroes, and so does
+         * every layer above it. */
+        if (count > 0) {
+            bytes = MIN(bytes, count);
+        }
+        if (ret || count == 0 || !next) {
+            *depth = d;
+            *pnum = bytes;
+            return 0;
+        }
+        layer = next;
+        d++;
+    }
+}
+
+/* Return the depth of the layer owning [@offset, @offset + @bytes) and set
+ * @extent_end to the end of the cached extent containing @offset.
+ */
+static int coroutine_fn chain_cache_get(BlockDriverState *bs,
+                                        int64_t offset,
+                                        int64_t *extent_end)
+{
+    BdrvChainCache *cache = bs->chain_cache;
+    BdrvChainCacheEntry *e = chain_cache_slot(cache, offset);
+    int64_t chunk_end = QEMU_ALIGN_UP(offset + 1, CHAIN_CACHE_CHUNK_SIZE);
+    uint64_t gen;
+    int64_t pnum;
+    int depth;
+    int ret;
+
+    qemu_mutex_lock(&cache->lock);
+    if (e->bytes && e->offset <= offset && offset < e->offset + e->bytes) {
+        depth = e->depth;
+        *extent_end = e->offset + e->bytes;
+        if (depth > 0) {
+            e->hits++;
+        }
+        qemu_mutex_unlock(&cache->lock);
+        trace_bdrv_chain_cache_hit(bs, offset, depth);
+        return depth;
+    }
+    gen = cache->gen;
+    qemu_mutex_unlock(&cache->lock);
+
+    ret = chain_cache_query(bs, offset, chunk_end - offset, &depth, &pnum);
+    if (ret < 0) {
+        return ret;
+    }
+    trace_bdrv_chain_cache_fill(bs, offset, pnum, depth);
+
+    qemu_mutex_lock(&cache->lock);
+    if (cache->gen == gen) {
+        *e = (BdrvChainCacheEntry) {
+            .offset = offset,
+            .bytes  = pnum,
+            .depth  = depth,
+            .hits   = depth > 0,
+        };
+    }
+    qemu_mutex_unlock(&cache->lock);
+
+    *extent_end = offset + pnum;
+    return depth;
+}
+
+/*
+ * Look up which layer owns [@offset, @offset + @bytes) of @bs, filling the
+ * cache as needed.  Returns 1 and sets @owner to the BdrvChild through which
+ * that layer is reached if it is a backing layer, 0 if the request should go
+ * to @bs itself (because @bs owns the data, or ownership is mixed).
+ *
+ * Must be called after the request has waited for overlapping serialising
+ * requests, so that their writes are reflected in the answer.
+ */
+int coroutine_fn bdrv_chain_cache_lookup(BlockDriverState *bs,
+                                         int64_t offset, int64_t bytes,
+                                         BdrvChild **owner)
+{
+    int64_t end = offset + bytes;
+    int depth = -1;
+    BdrvChild *c;
+
+    if (!bs->chain_cache || !bs->backing || bytes <= 0 ||
+        bytes > CHAIN_CACHE_MAX_CHUNKS * CHAIN_CACHE_CHUNK_SIZE) {
+        return 0;
+    }
+
+    while (offset < end) {
+        int64_t extent_end;
+        int d = chain_cache_get(bs, offset, &extent_end);
+
+        if (d <= 0 || (depth >= 0 && d != depth)) {
+            return 0;
+        }
+        depth = d;
+        offset = extent_end;
+    }
+
+    c = bs->backing;
+    while (--depth > 0) {
+        if (!c->bs->backing) {
+            /* The chain changed under us; the entry will be dropped */
+            return 0;
+        }
+        c = c->bs->backing;
+    }
+    *owner = c;
+    return 1;
+}
+
+/* Whether the range starting at @offset has been read from a backing layer
+ * often enough that it should be copied into @bs: with a threshold of N,
+ * the read following N such reads copies it.  Does not yield.
+ */
+bool bdrv_chain_cache_is_hot(BlockDriverState *bs, int64_t offset,
+                             int64_t bytes)
+{
+    BdrvChainCache *cache = bs->chain_cache;
+    BdrvChainCacheEntry *e;
+    bool hot;
+
+    if (!cache || !cache->cor_threshold || !bs->backing ||
+        bdrv_is_read_only(bs) || (bs->open_flags & BDRV_O_INACTIVE)) {
+        return false;
+    }
+
+    e = chain_cache_slot(cache, offset);
+    qemu_mutex_lock(&cache->lock);
+    hot = e->bytes && e->depth > 0 && e->hits >= cache->cor_threshold &&
+          e->offset <= offset && offset + bytes <= e->offset + e->bytes;
+    qemu_mutex_unlock(&cache->lock);
+    if (hot) {
+        trace_bdrv_chain_cache_copy_on_read(bs, offset, bytes);
+    }
+    return hot;
+}
@@ -1139,6 +1139,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
                  */
                 goto err;
             }
+            bdrv_chain_cache_invalidate(bs, cluster_offset, pnum);
 
             qemu_iovec_from_buf(qiov, progress, bounce_buffer + skip_bytes,
                                 pnum - skip_bytes);
@@ -1195,6 +1196,13 @@ static int coroutine_fn bdrv_aligned_preadv(BdrvChild *child,
      * passthrough flags.  */
     assert(!(flags & ~(BDRV_REQ_NO_SERIALISING | BDRV_REQ_COPY_ON_READ)));
 
+    /* Copy ranges that keep being read from deep in the backing chain */
+    if (bs->chain_cache && qiov &&
+        !(flags & (BDRV_REQ_NO_SERIALISING | BDRV_REQ_COPY_ON_READ)) &&
+        bdrv_chain_cache_is_hot(bs, offset, bytes)) {
+        flags |= BDRV_REQ_COPY_ON_READ;
+    }
+
     /* Handle Copy on Read and associated serialisation */
     if (flags & BDRV_REQ_COPY_ON_READ) {
         /* If we touch the same cluster it counts as an overlap.  This
@@ -1232,6 +1240,15 @@ static int coroutine_fn bdrv_aligned_preadv(BdrvChild *child,
 
     max_bytes = ROUND_UP(MAX(0, total_bytes - offset), align);
     if (bytes <= max_bytes && bytes <= max_transfer) {
+        BdrvChild *owner;
+
+        /* Skip the layers that would only defer to their backing file */
+        if (bs->chain_cache && qiov &&
+            bdrv_chain_cache_lookup(bs, offset, bytes, &owner) > 0) {
+            ret = bdrv_co_preadv(owner, offset, bytes, qiov, 0);
+            goto out;
+        }
+
         ret = bdrv_driver_preadv(bs, offset, bytes, qiov, 0);
         goto out;
     }
@@ -1562,6 +1579,7 @@ static int coroutine_fn bdrv_aligned_pwritev(BdrvChild *child,
 
     atomic_inc(&bs->write_gen);
     bdrv_set_dirty(bs, offset, bytes);
+    bdrv_chain_cache_invalidate(bs, offset, bytes);
 
     stat64_max(&bs->wr_highest_offset, offset + bytes);
 
@@ -1830,6 +1848,138 @@ int coroutine_fn bdrv_co_pwrite_zeroes(BdrvChild *child, int64_t offset,
                            BDRV_REQ_ZERO_WRITE | flags);
 }
 
+static int coroutine_fn bdrv_co_copy_range_internal(BdrvChild *src,
+                                                    uint64_t src_offset,
+                                                    BdrvChild *dst,
+                                                    uint64_t dst_offset,
+                                                    uint64_t bytes,
+                                                    BdrvRequestFlags flags,
+                                                    bool recurse_src)
+{
+    BdrvTrackedRequest req;
+    BlockDriverState *src_bs, *dst_bs;
+    int64_t end_sector;
+    int ret;
+
+    if (!dst || !dst->bs) {
+        return -ENOMEDIUM;
+    }
+    dst_bs = dst->bs;
+    ret = bdrv_check_byte_request(dst_bs, dst_offset, bytes);
+    if (ret) {
+        return ret;
+    }
+    if (flags & BDRV_REQ_ZERO_WRITE) {
+        /* The source is known to read as zeroes, @src may be NULL */
+        return bdrv_co_pwrite_zeroes(dst, dst_offset, bytes, flags);
+    }
+
+    if (!src || !src->bs) {
+        return -ENOMEDIUM;
+    }
+    src_bs = src->bs;
+    ret = bdrv_check_byte_request(src_bs, src_offset, bytes);
+    if (ret) {
+        return ret;
+    }
+
+    if (!src_bs->drv || !dst_bs->drv) {
+        return -ENOMEDIUM;
+    }
+    if (!src_bs->drv->bdrv_co_copy_range_from ||
+        !dst_bs->drv->bdrv_co_copy_range_to ||
+        src_bs->encrypted || dst_bs->encrypted ||
+        bdrv_has_readonly_bitmaps(dst_bs)) {
+        return -ENOTSUP;
+    }
+
+    /* No read-modify-write cycles here; unaligned requests take the
+     * normal path. */
+    if (!QEMU_IS_ALIGNED(src_offset | bytes, src_bs->bl.request_alignment) ||
+        !QEMU_IS_ALIGNED(dst_offset | bytes, dst_bs->bl.request_alignment)) {
+        return -ENOTSUP;
+    }
+
+    assert((src_bs->open_flags & BDRV_O_NO_IO) == 0);
+    assert((dst_bs->open_flags & BDRV_O_NO_IO) == 0);
+    assert(dst->perm & BLK_PERM_WRITE);
+    end_sector = DIV_ROUND_UP(dst_offset + bytes, BDRV_SECTOR_SIZE);
+    assert(end_sector <= dst_bs->total_sectors ||
+           dst->perm & BLK_PERM_RESIZE);
+
+    /* Both nodes stay busy for drain while the request descends the graph,
+     * but only the node whose driver is called has a tracked request. */
+    bdrv_inc_in_flight(src_bs);
+    bdrv_inc_in_flight(dst_bs);
+
+    if (recurse_src) {
+        tracked_request_begin(&req, src_bs, src_offset, bytes,
+                              BDRV_TRACKED_READ);
+        wait_serialising_requests(&req);
+        ret = src_bs->drv->bdrv_co_copy_range_from(src_bs, src, src_offset,
+                                                   dst, dst_offset,
+                                                   bytes, flags);
+    } else {
+        tracked_request_begin(&req, dst_bs, dst_offset, bytes,
+                              BDRV_TRACKED_WRITE);
+        wait_serialising_requests(&req);
+
+        ret = notifier_with_return_list_notify(&dst_bs->before_write_notifiers,
+                                               &req);
+        if (ret < 0) {
+            /* Do nothing, write notifier decided to fail this request */
+        } else {
+            ret = dst_bs->drv->bdrv_co_copy_range_to(dst_bs, src, src_offset,
+                                                     dst, dst_offset,
+                                                     bytes, flags);
+        }
+
+        if (ret != -ENOTSUP) {
+            atomic_inc(&dst_bs->write_gen);
+            bdrv_set_dirty(dst_bs, dst_offset, bytes);
+            bdrv_chain_cache_invalidate(dst_bs, dst_offset, bytes);
+            stat64_max(&dst_bs->wr_highest_offset, dst_offset + bytes);
+            if (ret >= 0) {
+                dst_bs->total_sectors = MAX(dst_bs->total_sectors,
+                                            end_sector);
+            }
+        }
+    }
+    tracked_request_end(&req);
+
+    bdrv_dec_in_flight(src_bs);
+    bdrv_dec_in_flight(dst_bs);
+    return ret < 0 ? ret : 0;
+}
+
+int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, uint64_t src_offset,
+                                         BdrvChild *dst, uint64_t dst_offset,
+                                         uint64_t bytes,
+                                         BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_internal(src, src_offset, dst, dst_offset,
+                                       bytes, flags, true);
+}
+
+int coroutine_fn bdrv_co_copy_range_to(BdrvChild *src, uint64_t src_offset,
+                                       BdrvChild *dst, uint64_t dst_offset,
+                                       uint64_t bytes,
+                                       BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_internal(src, src_offset, dst, dst_offset,
+                                       bytes, flags, false);
+}
+
+int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
+                                    BdrvChild *dst, uint64_t dst_offset,
+                                    uint64_t bytes, BdrvRequestFlags flags)
+{
+    trace_bdrv_co_copy_range(src->bs, src_offset, dst->bs, dst_offset,
+                             bytes, flags);
+    return bdrv_co_copy_range_from(src, src_offset, dst, dst_offset,
+                                   bytes, flags);
+}
+
 /*
  * Flush ALL BDSes regardless of if they are reachable via a BlkBackend or not.
  */
@@ -2677,6 +2827,7 @@ int coroutine_fn bdrv_co_pdiscard(BlockDriverState *bs, int64_t offset,
 out:
     atomic_inc(&bs->write_gen);
     bdrv_set_dirty(bs, req.offset, req.bytes);
+    bdrv_chain_cache_invalidate(bs, req.offset, req.bytes);
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
     return ret;
@@ -0,0 +1,447 @@
+/*
+ * Linux io_uring support.
+ *
+ * Modelled on linux-aio.c.  Unlike Linux AIO, io_uring is asynchronous
+ * for buffered I/O and supports fsync, so it does not need O_DIRECT.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+#include "qemu/coroutine.h"
+
+#include <liburing.h>
+
+/* Number of submission queue entries.  Requests beyond that wait in
+ * io_q.submit_queue until the ring has room.
+ */
+#define MAX_ENTRIES 128
+
+typedef struct LuringAIOCB {
+    Coroutine *co;
+    struct io_uring_sqe sqeq;
+    /* Where sqeq was copied in the submission ring */
+    struct io_uring_sqe *sqe;
+    ssize_t ret;
+    QEMUIOVector *qiov;
+    bool is_read;
+    QSIMPLEQ_ENTRY(LuringAIOCB) next;
+
+    /* Buffered reads may complete short even before EOF.  The rest of
+     * the request is then resubmitted using resubmit_qiov, which covers
+     * the part of qiov after the total_read bytes read so far.
+     */
+    int total_read;
+    QEMUIOVector resubmit_qiov;
+} LuringAIOCB;
+
+typedef struct LuringQueue {
+    int plugged;
+    unsigned int in_queue;
+    /* The first in_ring requests of submit_queue have been copied into
+     * the submission ring, but the kernel has not consumed them yet.
+     */
+    unsigned int in_ring;
+    unsigned int in_flight;
+    bool blocked;
+    /* Number of SQEs at the head of the submission ring that belonged to
+     * failed requests and were turned into no-ops.
+     */
+    unsigned int cancelled;
+    QSIMPLEQ_HEAD(, LuringAIOCB) submit_queue;
+} LuringQueue;
+
+struct LuringState {
+    AioContext *aio_context;
+
+    struct io_uring ring;
+
+    /* io queue for submit at batch.  Protected by AioContext lock. */
+    LuringQueue io_q;
+
+    /* I/O completion processing.  Only runs in I/O thread.  */
+    QEMUBH *completion_bh;
+};
+
+static void ioq_submit(LuringState *s);
+
+/*
+ * Queue a request that completed short for resubmission.  It cannot go
+ * ahead of the requests that already sit in the submission ring, so it
+ * simply goes to the end of the queue.
+ */
+static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
+{
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+}
+
+static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
+                                       int nread)
+{
+    QEMUIOVector *resubmit_qiov;
+    size_t remaining;
+
+    luringcb->total_read += nread;
+    remaining = luringcb->qiov->size - luringcb->total_read;
+
+    resubmit_qiov = &luringcb->resubmit_qiov;
+    if (resubmit_qiov->iov == NULL) {
+        qemu_iovec_init(resubmit_qiov, luringcb->qiov->niov);
+    } else {
+        qemu_iovec_reset(resubmit_qiov);
+    }
+    qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
+                      remaining);
+
+    luringcb->sqeq.off += nread;
+    luringcb->sqeq.addr = (__u64)(uintptr_t)resubmit_qiov->iov;
+    luringcb->sqeq.len = resubmit_qiov->niov;
+
+    luring_resubmit(s, luringcb);
+}
+
+static void luring_complete(LuringAIOCB *luringcb, int ret)
+{
+    if (luringcb->resubmit_qiov.iov != NULL) {
+        qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    }
+
+    luringcb->ret = ret;
+    /* If the coroutine is already entered it must be in ioq_submit()
+     * and will notice luringcb->ret has been filled in when it
+     * eventually runs later.  Coroutines cannot be entered recursively
+     * so avoid doing that!
+     */
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
+/**
+ * luring_process_completions:
+ * @s: io_uring state
+ *
+ * Fetches completed I/O requests and wakes up their coroutines.
+ *
+ * Like qemu_laio_process_completions(), this supports nested event loops
+ * by scheduling the completion BH before running any callbacks, so that
+ * a nested aio_poll() still sees the remaining completions.  The BH also
+ * stays scheduled if a short read was queued again, so that it gets
+ * submitted even if nothing else completes.
+ */
+static void luring_process_completions(LuringState *s)
+{
+    struct io_uring_cqe *cqe;
+    bool resubmitted = false;
+
+    /* Reschedule so nested event loops see currently pending completions */
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0 && cqe) {
+        LuringAIOCB *luringcb = io_uring_cqe_get_data(cqe);
+        int ret = cqe->res;
+
+        io_uring_cqe_seen(&s->ring, cqe);
+        if (!luringcb) {
+            /* No-op left behind by ioq_cancel() */
+            continue;
+        }
+
+        /* Change counters one-by-one because we can be nested. */
+        s->io_q.in_flight--;
+
+        if (luringcb->qiov) {
+            if (ret >= 0 && luringcb->is_read) {
+                ret += luringcb->total_read;
+            }
+            if (ret == luringcb->qiov->size) {
+                ret = 0;
+            } else if (ret >= 0) {
+                if (!luringcb->is_read) {
+                    ret = -ENOSPC;
+                } else if (ret > luringcb->total_read) {
+                    /* Short read, not at EOF: read the rest.  */
+                    luring_resubmit_short_read(s, luringcb,
+                                               ret - luringcb->total_read);
+                    resubmitted = true;
+                    continue;
+                } else {
+                    /* Short reads mean EOF, pad with zeros. */
+                    qemu_iovec_memset(luringcb->qiov, ret, 0,
+                                      luringcb->qiov->size - ret);
+                    ret = 0;
+                }
+            }
+        } else if (ret > 0) {
+            ret = 0;
+        }
+
+        luring_complete(luringcb, ret);
+    }
+
+    if (!resubmitted) {
+        qemu_bh_cancel(s->completion_bh);
+    }
+}
+
+static void luring_process_completions_and_submit(LuringState *s)
+{
+    luring_process_completions(s);
+
+    aio_context_acquire(s->aio_context);
+    if (!s->io_q.plugged && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
+static void qemu_luring_completion_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static void qemu_luring_completion_cb(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static bool qemu_luring_poll_cb(void *opaque)
+{
+    LuringState *s = opaque;
+    struct io_uring_cqe *cqe;
+
+    if (io_uring_peek_cqe(&s->ring, &cqe) != 0 || !cqe) {
+        return false;
+    }
+
+    luring_process_completions_and_submit(s);
+    return true;
+}
+
+static void ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->submit_queue);
+    io_q->plugged = 0;
+    io_q->in_queue = 0;
+    io_q->in_ring = 0;
+    io_q->in_flight = 0;
+    io_q->blocked = false;
+    io_q->cancelled = 0;
+}
+
+/*
+ * Fail the requests that io_uring_enter could not submit.  Their SQEs
+ * cannot be taken out of the ring, but the kernel has not read them yet,
+ * so they are turned into no-ops that the next io_uring_enter consumes.
+ * If the ring held no request (only no-ops), fail the first queued one
+ * so that every failed io_uring_enter makes progress.
+ */
+static void ioq_cancel(LuringState *s, int ret)
+{
+    LuringAIOCB *luringcb;
+    unsigned int n = MAX(s->io_q.in_ring, 1);
+
+    while (n-- > 0) {
+        luringcb = QSIMPLEQ_FIRST(&s->io_q.submit_queue);
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        s->io_q.in_queue--;
+        if (s->io_q.in_ring > 0) {
+            io_uring_prep_nop(luringcb->sqe);
+            io_uring_sqe_set_data(luringcb->sqe, NULL);
+            s->io_q.in_ring--;
+            s->io_q.cancelled++;
+        }
+        luring_complete(luringcb, ret);
+    }
+}
+
+/*
+ * Copy as many queued requests as fit into the submission ring, and
+ * submit them all with a single io_uring_enter.  Requests only leave
+ * submit_queue once the kernel has consumed their SQE.
+ */
+static void ioq_submit(LuringState *s)
+{
+    int ret, n;
+    unsigned int skip;
+    LuringAIOCB *luringcb;
+
+    while (s->io_q.in_queue > 0) {
+        /* Requests that are already in the ring must not be copied again */
+        skip = s->io_q.in_ring;
+        QSIMPLEQ_FOREACH(luringcb, &s->io_q.submit_queue, next) {
+            struct io_uring_sqe *sqe;
+
+            if (skip > 0) {
+                skip--;
+                continue;
+            }
+            sqe = io_uring_get_sqe(&s->ring);
+            if (!sqe) {
+                break;
+            }
+            *sqe = luringcb->sqeq;
+            luringcb->sqe = sqe;
+            s->io_q.in_ring++;
+        }
+
+        do {
+            ret = io_uring_submit(&s->ring);
+        } while (ret == -EINTR || ret == -EAGAIN);
+
+        if (ret == 0 || ret == -EBUSY) {
+            /* The completion queue is full.  The SQEs stay in the ring and
+             * are submitted by the next io_uring_enter, from the completion
+             * path.  Errors in individual requests are reported in their
+             * CQEs.
+             */
+            break;
+        }
+        if (ret < 0) {
+            ioq_cancel(s, ret);
+            continue;
+        }
+
+        /* Left-over no-ops are at the head of the ring */
+        n = MIN(ret, s->io_q.cancelled);
+        s->io_q.cancelled -= n;
+        ret -= n;
+
+        s->io_q.in_flight += ret;
+        s->io_q.in_queue  -= ret;
+        s->io_q.in_ring   -= ret;
+        while (ret-- > 0) {
+            QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        }
+    }
+    s->io_q.blocked = (s->io_q.in_queue > 0);
+
+    if (s->io_q.in_flight) {
+        /* We can try to complete something just right away if there are
+         * still requests in-flight. */
+        luring_process_completions(s);
+    }
+}
+
+void luring_io_plug(BlockDriverState *bs, LuringState *s)
+{
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, LuringState *s)
+{
+    assert(s->io_q.plugged);
+    if (--s->io_q.plugged == 0 &&
+        !s->io_q.blocked && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+}
+
+static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
+                            uint64_t offset, int type)
+{
+    struct io_uring_sqe *sqes = &luringcb->sqeq;
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                             luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_READ:
+        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                            luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return -EIO;
+    }
+    io_uring_sqe_set_data(sqes, luringcb);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged ||
+         s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
+        ioq_submit(s);
+    }
+
+    return 0;
+}
+
+int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type)
+{
+    int ret;
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+        .qiov       = qiov,
+        .is_read    = (type == QEMU_AIO_READ),
+    };
+
+    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+}
+
+void luring_detach_aio_context(LuringState *s, AioContext *old_context)
+{
+    aio_set_fd_handler(old_context, s->ring.ring_fd, false,
+                       NULL, NULL, NULL, s);
+    qemu_bh_delete(s->completion_bh);
+    s->aio_context = NULL;
+}
+
+void luring_attach_aio_context(LuringState *s, AioContext *new_context)
+{
+    s->aio_context = new_context;
+    s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
+                       qemu_luring_completion_cb, NULL,
+                       qemu_luring_poll_cb, s);
+}
+
+LuringState *luring_init(Error **errp)
+{
+    int rc;
+    LuringState *s;
+
+    s = g_new0(LuringState, 1);
+    rc = io_uring_queue_init(MAX_ENTRIES, &s->ring, 0);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+        g_free(s);
+        return NULL;
+    }
+
+    ioq_init(&s->io_q);
+    return s;
+}
+
+void luring_cleanup(LuringState *s)
+{
+    io_uring_queue_exit(&s->ring);
+    g_free(s);
+}
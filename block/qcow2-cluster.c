@@ -24,6 +24,9 @@
 
 #include "qemu/osdep.h"
 #include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 #include "qapi/error.h"
 #include "qemu-common.h"
@@ -1545,8 +1548,8 @@ again:
     return 0;
 }
 
-static int decompress_buffer(uint8_t *out_buf, int out_buf_size,
-                             const uint8_t *buf, int buf_size)
+static int zlib_decompress_buffer(uint8_t *out_buf, int out_buf_size,
+                                  const uint8_t *buf, int buf_size)
 {
     z_stream strm1, *strm = &strm1;
     int ret, out_len;
@@ -1572,6 +1575,67 @@ static int decompress_buffer(uint8_t *out_buf, int out_buf_size,
     return 0;
 }
 
+#ifdef CONFIG_ZSTD
+/*
+ * @buf is rounded up to whole sectors and may contain garbage after the
+ * compressed data, so use the streaming API, which stops at the end of
+ * the frame, rather than ZSTD_decompress(), which would consume all of it.
+ */
+static int zstd_decompress_buffer(uint8_t *out_buf, int out_buf_size,
+                                  const uint8_t *buf, int buf_size)
+{
+    ZSTD_outBuffer output = { out_buf, out_buf_size, 0 };
+    ZSTD_inBuffer input = { buf, buf_size, 0 };
+    ZSTD_DStream *dstream;
+    size_t zstd_ret;
+    int ret = 0;
+
+    dstream = ZSTD_createDStream();
+    if (!dstream) {
+        return -1;
+    }
+    ZSTD_initDStream(dstream);
+
+    /* The data may span several frames; stop when the cluster is full */
+    while (output.pos < output.size) {
+        size_t last_in_pos = input.pos;
+        size_t last_out_pos = output.pos;
+
+        zstd_ret = ZSTD_decompressStream(dstream, &output, &input);
+        if (ZSTD_isError(zstd_ret)) {
+            ret = -1;
+            break;
+        }
+
+        /* No progress means the input ended before the cluster did */
+        if (input.pos == last_in_pos && output.pos == last_out_pos) {
+            ret = -1;
+            break;
+        }
+    }
+
+    ZSTD_freeDStream(dstream);
+    return ret;
+}
+#endif
+
+static int decompress_buffer(BDRVQcow2State *s,
+                             uint8_t *out_buf, int out_buf_size,
+                             const uint8_t *buf, int buf_size)
+{
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return zlib_decompress_buffer(out_buf, out_buf_size, buf, buf_size);
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return zstd_decompress_buffer(out_buf, out_buf_size, buf, buf_size);
+#endif
+    default:
+        /* validate_compression_type() rejects anything else on open */
+        abort();
+    }
+}
+
 int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -1606,7 +1670,7 @@ int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset)
         if (ret < 0) {
             return ret;
         }
-        if (decompress_buffer(s->cluster_cache, s->cluster_size,
+        if (decompress_buffer(s, s->cluster_cache, s->cluster_size,
                               s->cluster_data + sector_offset, csize) < 0) {
             return -EIO;
         }
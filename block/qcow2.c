@@ -26,6 +26,10 @@
 #include "sysemu/block-backend.h"
 #include "qemu/module.h"
 #include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
 #include "block/qcow2.h"
 #include "qemu/error-report.h"
 #include "qapi/qmp/qerror.h"
@@ -39,6 +43,7 @@
 #include "qapi/opts-visitor.h"
 #include "qapi-visit.h"
 #include "block/crypto.h"
+#include "block/thread-pool.h"
 
 /*
   Differences with QCOW:
@@ -675,6 +680,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_PREALLOC_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Grow the image file by this many bytes at once when "
+                    "allocating clusters at its end",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -742,6 +753,8 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     BDRVQcow2State *s = bs->opaque;
     uint64_t combined_cache_size;
     bool l2_cache_size_set, refcount_cache_size_set, combined_cache_size_set;
+    uint64_t virtual_disk_size = bs->total_sectors * BDRV_SECTOR_SIZE;
+    uint64_t max_l2_cache;
 
     combined_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_CACHE_SIZE);
     l2_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_L2_CACHE_SIZE);
@@ -779,9 +792,11 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
         }
     } else {
         if (!l2_cache_size_set && !refcount_cache_size_set) {
-            *l2_cache_size = MAX(DEFAULT_L2_CACHE_BYTE_SIZE,
-                                 (uint64_t)DEFAULT_L2_CACHE_CLUSTERS
-                                 * s->cluster_size);
+            /* Enough L2 tables to map the whole image */
+            max_l2_cache = ROUND_UP(DIV_ROUND_UP(virtual_disk_size,
+                                                 s->cluster_size) * 8,
+                                    s->cluster_size);
+            *l2_cache_size = MIN(max_l2_cache, DEFAULT_L2_CACHE_MAX_SIZE);
             *refcount_cache_size = *l2_cache_size
                                  / DEFAULT_L2_REFCOUNT_SIZE_RATIO;
         } else if (!l2_cache_size_set) {
@@ -801,6 +816,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t prealloc_size;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -904,6 +920,15 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->prealloc_size = qemu_opt_get_size(opts, QCOW2_OPT_PREALLOC_SIZE,
+                                         s->prealloc_size);
+    if (r->prealloc_size > INT_MAX) {
+        error_setg(errp, QCOW2_OPT_PREALLOC_SIZE " too big");
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->prealloc_size = ROUND_UP(r->prealloc_size, s->cluster_size);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1055,6 +1080,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->prealloc_size = r->prealloc_size;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1087,6 +1114,38 @@ static int qcow2_update_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+static int validate_compression_type(BDRVQcow2State *s, Error **errp)
+{
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+#endif
+        break;
+
+    default:
+        error_setg(errp, "qcow2: unknown compression type: %u",
+                   s->compression_type);
+        return -ENOTSUP;
+    }
+
+    /* The compression type bit must be set exactly for non-zlib images, so
+     * that versions which only know about zlib refuse to open them */
+    if (s->compression_type == QCOW2_COMPRESSION_TYPE_ZLIB) {
+        if (s->incompatible_features & QCOW2_INCOMPAT_COMPRESSION) {
+            error_setg(errp, "qcow2: compression type incompatible feature "
+                       "bit must not be set for zlib compression");
+            return -EINVAL;
+        }
+    } else if (!(s->incompatible_features & QCOW2_INCOMPAT_COMPRESSION)) {
+        error_setg(errp, "qcow2: compression type incompatible feature bit "
+                   "must be set for non-zlib compression");
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
 static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
                          Error **errp)
 {
@@ -1183,6 +1242,12 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    if (header.header_length > offsetof(QCowHeader, compression_type)) {
+        s->compression_type = header.compression_type;
+    } else {
+        s->compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
+    }
+
     if (header.backing_file_offset > s->cluster_size) {
         error_setg(errp, "Invalid backing file offset");
         ret = -EINVAL;
@@ -1212,6 +1277,11 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    ret = validate_compression_type(s, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
     if (s->incompatible_features & QCOW2_INCOMPAT_CORRUPT) {
         /* Corrupt images may not be written to unless they are being repaired
          */
@@ -1858,6 +1928,96 @@ static bool merge_cow(uint64_t offset, unsigned bytes,
     return false;
 }
 
+/*
+ * Make sure that the image file extends at least up to @end before a newly
+ * allocated cluster range ending there is written.  If it does not, grow the
+ * file by s->prealloc_size bytes more than needed, so that the following
+ * allocating writes land inside the file.  Writes that extend a file
+ * serialize in the host filesystem, writes inside it do not.
+ *
+ * Only the area past both the file end and s->prealloc_end is zeroed: data
+ * writes in flight without s->lock always lie below s->prealloc_end, and
+ * metadata is only written with s->lock held.
+ *
+ * Must be called with s->lock held.
+ */
+static int coroutine_fn qcow2_prealloc_file(BlockDriverState *bs,
+                                            uint64_t end)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t file_length;
+    uint64_t start, new_end;
+    int ret;
+
+    end = ROUND_UP(end, s->cluster_size);
+    if (!s->prealloc_size || end <= s->prealloc_end) {
+        return 0;
+    }
+
+    file_length = bdrv_getlength(bs->file->bs);
+    if (file_length < 0) {
+        return file_length;
+    }
+
+    start = MAX(file_length, s->prealloc_end);
+    if (end <= start) {
+        s->prealloc_end = start;
+        return 0;
+    }
+
+    new_end = end + s->prealloc_size;
+    while (start < new_end) {
+        int bytes = MIN(new_end - start, BDRV_REQUEST_MAX_BYTES);
+
+        ret = bdrv_co_pwrite_zeroes(bs->file, start, bytes, 0);
+        if (ret < 0) {
+            return ret;
+        }
+        start += bytes;
+        s->prealloc_end = start;
+    }
+
+    return 0;
+}
+
+/*
+ * Finish the cluster allocations in *pl2meta: if @link_l2 is true, update
+ * the L2 tables for them, then take them off the list of running requests.
+ * On error, *pl2meta points to the allocations that remain to be released.
+ */
+static int coroutine_fn qcow2_handle_l2meta(BlockDriverState *bs,
+                                            QCowL2Meta **pl2meta,
+                                            bool link_l2)
+{
+    int ret = 0;
+    QCowL2Meta *l2meta = *pl2meta;
+
+    while (l2meta != NULL) {
+        QCowL2Meta *next;
+
+        if (link_l2) {
+            ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
+            if (ret) {
+                goto out;
+            }
+        }
+
+        /* Take the request off the list of running requests */
+        if (l2meta->nb_clusters != 0) {
+            QLIST_REMOVE(l2meta, next_in_flight);
+        }
+
+        qemu_co_queue_restart_all(&l2meta->dependent_requests);
+
+        next = l2meta->next;
+        g_free(l2meta);
+        l2meta = next;
+    }
+out:
+    *pl2meta = l2meta;
+    return ret;
+}
+
 static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                          uint64_t bytes, QEMUIOVector *qiov,
                                          int flags)
@@ -1940,6 +2100,14 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
             goto fail;
         }
 
+        if (l2meta != NULL) {
+            ret = qcow2_prealloc_file(bs, cluster_offset +
+                                      offset_in_cluster + cur_bytes);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+
         /* If we need to do COW, check if it's possible to merge the
          * writing of the guest data together with that of the COW regions.
          * If it's not possible (or not necessary) then write the
@@ -1958,24 +2126,9 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
             }
         }
 
-        while (l2meta != NULL) {
-            QCowL2Meta *next;
-
-            ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
-            if (ret < 0) {
-                goto fail;
-            }
-
-            /* Take the request off the list of running requests */
-            if (l2meta->nb_clusters != 0) {
-                QLIST_REMOVE(l2meta, next_in_flight);
-            }
-
-            qemu_co_queue_restart_all(&l2meta->dependent_requests);
-
-            next = l2meta->next;
-            g_free(l2meta);
-            l2meta = next;
+        ret = qcow2_handle_l2meta(bs, &l2meta, true);
+        if (ret < 0) {
+            goto fail;
         }
 
         bytes -= cur_bytes;
@@ -1986,24 +2139,229 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
     ret = 0;
 
 fail:
-    while (l2meta != NULL) {
-        QCowL2Meta *next;
+    qcow2_handle_l2meta(bs, &l2meta, false);
 
-        if (l2meta->nb_clusters != 0) {
-            QLIST_REMOVE(l2meta, next_in_flight);
+    qemu_co_mutex_unlock(&s->lock);
+
+    qemu_iovec_destroy(&hd_qiov);
+    qemu_vfree(cluster_data);
+    trace_qcow2_writev_done_req(qemu_coroutine_self(), ret);
+
+    return ret;
+}
+
+static int coroutine_fn
+qcow2_co_copy_range_from(BlockDriverState *bs,
+                         BdrvChild *src, uint64_t src_offset,
+                         BdrvChild *dst, uint64_t dst_offset,
+                         uint64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+    unsigned int cur_bytes; /* number of bytes in current iteration */
+    uint64_t cluster_offset = 0;
+
+    assert(!bs->encrypted);
+    qemu_co_mutex_lock(&s->lock);
+
+    while (bytes != 0) {
+        BdrvChild *child = NULL;
+        uint64_t copy_offset = 0;
+        BdrvRequestFlags cur_flags = flags;
+
+        cur_bytes = MIN(bytes, INT_MAX);
+        ret = qcow2_get_cluster_offset(bs, src_offset, &cur_bytes,
+                                       &cluster_offset);
+        if (ret < 0) {
+            goto out;
         }
-        qemu_co_queue_restart_all(&l2meta->dependent_requests);
 
-        next = l2meta->next;
-        g_free(l2meta);
-        l2meta = next;
+        switch (ret) {
+        case QCOW2_CLUSTER_UNALLOCATED:
+            if (bs->backing && bs->backing->bs) {
+                int64_t backing_length = bdrv_getlength(bs->backing->bs);
+                if (backing_length < 0) {
+                    ret = backing_length;
+                    goto out;
+                }
+                if (src_offset >= backing_length) {
+                    cur_flags |= BDRV_REQ_ZERO_WRITE;
+                } else {
+                    child = bs->backing;
+                    cur_bytes = MIN(cur_bytes, backing_length - src_offset);
+                    copy_offset = src_offset;
+                }
+            } else {
+                cur_flags |= BDRV_REQ_ZERO_WRITE;
+            }
+            break;
+
+        case QCOW2_CLUSTER_ZERO_PLAIN:
+        case QCOW2_CLUSTER_ZERO_ALLOC:
+            cur_flags |= BDRV_REQ_ZERO_WRITE;
+            break;
+
+        case QCOW2_CLUSTER_COMPRESSED:
+            ret = -ENOTSUP;
+            goto out;
+
+        case QCOW2_CLUSTER_NORMAL:
+            child = bs->file;
+            copy_offset = cluster_offset + offset_into_cluster(s, src_offset);
+            break;
+
+        default:
+            abort();
+        }
+
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_copy_range_from(child, copy_offset,
+                                      dst, dst_offset,
+                                      cur_bytes, cur_flags);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto out;
+        }
+
+        bytes -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
     }
+    ret = 0;
 
+out:
     qemu_co_mutex_unlock(&s->lock);
+    return ret;
+}
 
-    qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cluster_data);
-    trace_qcow2_writev_done_req(qemu_coroutine_self(), ret);
+/* Buffer size for qcow2_co_copy_bounce() */
+#define QCOW2_COPY_BOUNCE_SIZE (1 * 1024 * 1024)
+
+/*
+ * Copy @bytes from @src to the image file at @host_offset by reading and
+ * writing the data.  Used when the copy cannot be offloaded after clusters
+ * have already been allocated for it.
+ */
+static int coroutine_fn qcow2_co_copy_bounce(BlockDriverState *bs,
+                                             BdrvChild *src,
+                                             uint64_t src_offset,
+                                             uint64_t host_offset,
+                                             uint64_t bytes)
+{
+    size_t buf_size = MIN(bytes, QCOW2_COPY_BOUNCE_SIZE);
+    QEMUIOVector qiov;
+    struct iovec iov;
+    uint8_t *buf;
+    int ret = 0;
+
+    buf = qemu_try_blockalign(bs->file->bs, buf_size);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    while (bytes != 0) {
+        iov.iov_base = buf;
+        iov.iov_len = MIN(bytes, buf_size);
+        qemu_iovec_init_external(&qiov, &iov, 1);
+
+        ret = bdrv_co_preadv(src, src_offset, iov.iov_len, &qiov, 0);
+        if (ret < 0) {
+            break;
+        }
+        BLKDBG_EVENT(bs->file, BLKDBG_WRITE_AIO);
+        ret = bdrv_co_pwritev(bs->file, host_offset, iov.iov_len, &qiov, 0);
+        if (ret < 0) {
+            break;
+        }
+
+        bytes -= iov.iov_len;
+        src_offset += iov.iov_len;
+        host_offset += iov.iov_len;
+    }
+
+    qemu_vfree(buf);
+    return ret < 0 ? ret : 0;
+}
+
+static int coroutine_fn
+qcow2_co_copy_range_to(BlockDriverState *bs,
+                       BdrvChild *src, uint64_t src_offset,
+                       BdrvChild *dst, uint64_t dst_offset,
+                       uint64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int offset_in_cluster;
+    int ret;
+    unsigned int cur_bytes; /* number of bytes in current iteration */
+    uint64_t cluster_offset;
+    QCowL2Meta *l2meta = NULL;
+
+    assert(!bs->encrypted);
+    s->cluster_cache_offset = -1; /* disable compressed cache */
+
+    qemu_co_mutex_lock(&s->lock);
+
+    while (bytes != 0) {
+
+        l2meta = NULL;
+
+        offset_in_cluster = offset_into_cluster(s, dst_offset);
+        cur_bytes = MIN(bytes, INT_MAX);
+
+        ret = qcow2_alloc_cluster_offset(bs, dst_offset, &cur_bytes,
+                                         &cluster_offset, &l2meta);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        assert((cluster_offset & 511) == 0);
+
+        ret = qcow2_pre_write_overlap_check(bs, 0,
+                cluster_offset + offset_in_cluster, cur_bytes);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        if (l2meta != NULL) {
+            ret = qcow2_prealloc_file(bs, cluster_offset +
+                                      offset_in_cluster + cur_bytes);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_copy_range_to(src, src_offset,
+                                    bs->file,
+                                    cluster_offset + offset_in_cluster,
+                                    cur_bytes, flags);
+        if (ret == -ENOTSUP) {
+            /* The clusters are allocated already, so write the data
+             * ourselves instead of failing the request */
+            ret = qcow2_co_copy_bounce(bs, src, src_offset,
+                                       cluster_offset + offset_in_cluster,
+                                       cur_bytes);
+        }
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        ret = qcow2_handle_l2meta(bs, &l2meta, true);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        bytes -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
+    }
+    ret = 0;
+
+fail:
+    qcow2_handle_l2meta(bs, &l2meta, false);
+
+    qemu_co_mutex_unlock(&s->lock);
 
     return ret;
 }
@@ -2190,6 +2548,7 @@ int qcow2_update_header(BlockDriverState *bs)
         .autoclear_features     = cpu_to_be64(s->autoclear_features),
         .refcount_order         = cpu_to_be32(s->refcount_order),
         .header_length          = cpu_to_be32(header_length),
+        .compression_type       = s->compression_type,
     };
 
     /* For older versions, write a shorter header */
@@ -2264,6 +2623,11 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_INCOMPAT_CORRUPT_BITNR,
                 .name = "corrupt bit",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_COMPRESSION_BITNR,
+                .name = "compression type",
+            },
             {
                 .type = QCOW2_FEAT_TYPE_COMPATIBLE,
                 .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
@@ -2690,11 +3054,41 @@ static uint64_t qcow2_opt_get_refcount_bits_del(QemuOpts *opts, int version,
     return refcount_bits;
 }
 
+static int qcow2_opt_get_compression_type_del(QemuOpts *opts, int version,
+                                              Error **errp)
+{
+    char *buf;
+    int ret;
+
+    buf = qemu_opt_get_del(opts, BLOCK_OPT_COMPRESSION_TYPE);
+    if (!buf || !strcmp(buf, "zlib")) {
+        ret = QCOW2_COMPRESSION_TYPE_ZLIB;
+#ifdef CONFIG_ZSTD
+    } else if (!strcmp(buf, "zstd")) {
+        ret = QCOW2_COMPRESSION_TYPE_ZSTD;
+#endif
+    } else {
+        error_setg(errp, "Invalid compression type: '%s'", buf);
+        ret = -EINVAL;
+    }
+    g_free(buf);
+
+    if (version < 3 && ret > QCOW2_COMPRESSION_TYPE_ZLIB) {
+        error_setg(errp, "Non-zlib compression type is only supported with "
+                   "compatibility level 1.1 and above (use compat=1.1 or "
+                   "greater)");
+        ret = -EINVAL;
+    }
+
+    return ret;
+}
+
 static int qcow2_create2(const char *filename, int64_t total_size,
                          const char *backing_file, const char *backing_format,
                          int flags, size_t cluster_size, PreallocMode prealloc,
                          QemuOpts *opts, int version, int refcount_order,
-                         const char *encryptfmt, Error **errp)
+                         int compression_type, const char *encryptfmt,
+                         Error **errp)
 {
     QDict *options;
 
@@ -2812,6 +3206,15 @@ static int qcow2_create2(const char *filename, int64_t total_size,
         abort();
     }
 
+    /* Non-zlib compression needs the header field and the incompatible
+     * feature bit, both of which are written with the full header */
+    if (compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        BDRVQcow2State *s = blk_bs(blk)->opaque;
+
+        s->compression_type = compression_type;
+        s->incompatible_features |= QCOW2_INCOMPAT_COMPRESSION;
+    }
+
     /* Create a full header (including things like feature table) */
     ret = qcow2_update_header(blk_bs(blk));
     if (ret < 0) {
@@ -2893,6 +3296,7 @@ static int qcow2_create(const char *filename, QemuOpts *opts, Error **errp)
     int version;
     uint64_t refcount_bits;
     int refcount_order;
+    int compression_type;
     char *encryptfmt = NULL;
     Error *local_err = NULL;
     int ret;
@@ -2962,9 +3366,17 @@ static int qcow2_create(const char *filename, QemuOpts *opts, Error **errp)
 
     refcount_order = ctz32(refcount_bits);
 
+    compression_type = qcow2_opt_get_compression_type_del(opts, version,
+                                                          &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto finish;
+    }
+
     ret = qcow2_create2(filename, size, backing_file, backing_fmt, flags,
                         cluster_size, prealloc, opts, version, refcount_order,
-                        encryptfmt, &local_err);
+                        compression_type, encryptfmt, &local_err);
     error_propagate(errp, local_err);
 
 finish:
@@ -3151,6 +3563,7 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
         if ((last_cluster + 1) * s->cluster_size < old_file_size) {
             Error *local_err = NULL;
 
+            s->prealloc_end = 0;
             bdrv_truncate(bs->file, (last_cluster + 1) * s->cluster_size,
                           PREALLOC_MODE_OFF, &local_err);
             if (local_err) {
@@ -3302,6 +3715,131 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
     return 0;
 }
 
+/*
+ * qcow2_zlib_compress()
+ *
+ * @dest - destination buffer, at least of @dest_size
+ * @src - source buffer, @src_size bytes
+ *
+ * Returns: compressed size on success
+ *          -1 if compressed data does not fit into @dest_size bytes
+ *          -2 on any other error
+ */
+static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
+                                   const void *src, size_t src_size)
+{
+    ssize_t ret;
+    z_stream strm;
+
+    /* best compression, small window, no zlib header */
+    memset(&strm, 0, sizeof(strm));
+    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                       -12, 9, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        return -2;
+    }
+
+    /* strm.next_in is not const in old zlib versions, such as those used on
+     * OpenBSD/NetBSD, so cast the const away */
+    strm.avail_in = src_size;
+    strm.next_in = (void *) src;
+    strm.avail_out = dest_size;
+    strm.next_out = dest;
+
+    ret = deflate(&strm, Z_FINISH);
+    if (ret == Z_STREAM_END) {
+        ret = dest_size - strm.avail_out;
+    } else {
+        ret = (ret == Z_OK ? -1 : -2);
+    }
+
+    deflateEnd(&strm);
+
+    return ret;
+}
+
+#ifdef CONFIG_ZSTD
+/*
+ * qcow2_zstd_compress()
+ *
+ * Compresses @src into a single zstd frame.  Same parameters and return
+ * value as qcow2_zlib_compress().
+ */
+static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
+                                   const void *src, size_t src_size)
+{
+    size_t ret;
+
+    ret = ZSTD_compress(dest, dest_size, src, src_size, ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(ret)) {
+        return ZSTD_getErrorCode(ret) == ZSTD_error_dstSize_tooSmall ? -1 : -2;
+    }
+
+    return ret;
+}
+#endif
+
+typedef ssize_t Qcow2CompressFunc(void *dest, size_t dest_size,
+                                  const void *src, size_t src_size);
+
+typedef struct Qcow2CompressData {
+    void *dest;
+    size_t dest_size;
+    const void *src;
+    size_t src_size;
+    ssize_t ret;
+
+    Qcow2CompressFunc *func;
+} Qcow2CompressData;
+
+static int qcow2_compress_pool_func(void *opaque)
+{
+    Qcow2CompressData *data = opaque;
+
+    data->ret = data->func(data->dest, data->dest_size,
+                           data->src, data->src_size);
+
+    return 0;
+}
+
+/*
+ * Compress with the image's compression type in the AioContext's thread
+ * pool, so that parallel compressed writes (e.g. from qemu-img convert -c
+ * -W) use more than one host CPU.  See qcow2_zlib_compress() for the
+ * parameters and return value.
+ */
+static ssize_t coroutine_fn
+qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
+                  const void *src, size_t src_size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    Qcow2CompressData arg = {
+        .dest = dest,
+        .dest_size = dest_size,
+        .src = src,
+        .src_size = src_size,
+    };
+
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        arg.func = qcow2_zlib_compress;
+        break;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        arg.func = qcow2_zstd_compress;
+        break;
+#endif
+    default:
+        /* validate_compression_type() rejects anything else on open */
+        abort();
+    }
+
+    thread_pool_submit_co(pool, qcow2_compress_pool_func, &arg);
+
+    return arg.ret;
+}
+
 /* XXX: put compressed sectors first, then all the cluster aligned
    tables to avoid losing bytes in alignment */
 static coroutine_fn int
@@ -3311,8 +3849,8 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
     BDRVQcow2State *s = bs->opaque;
     QEMUIOVector hd_qiov;
     struct iovec iov;
-    z_stream strm;
-    int ret, out_len;
+    int ret;
+    ssize_t out_len;
     uint8_t *buf, *out_buf;
     int64_t cluster_offset;
 
@@ -3345,32 +3883,12 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
 
     out_buf = g_malloc(s->cluster_size);
 
-    /* best compression, small window, no zlib header */
-    memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
-                       Z_DEFLATED, -12,
-                       9, Z_DEFAULT_STRATEGY);
-    if (ret != 0) {
-        ret = -EINVAL;
-        goto fail;
-    }
-
-    strm.avail_in = s->cluster_size;
-    strm.next_in = (uint8_t *)buf;
-    strm.avail_out = s->cluster_size;
-    strm.next_out = out_buf;
-
-    ret = deflate(&strm, Z_FINISH);
-    if (ret != Z_STREAM_END && ret != Z_OK) {
-        deflateEnd(&strm);
+    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
+                                buf, s->cluster_size);
+    if (out_len == -2) {
         ret = -EINVAL;
         goto fail;
-    }
-    out_len = strm.next_out - out_buf;
-
-    deflateEnd(&strm);
-
-    if (ret != Z_STREAM_END || out_len >= s->cluster_size) {
+    } else if (out_len == -1) {
         /* could not compress: write normal cluster */
         ret = qcow2_co_pwritev(bs, offset, bytes, qiov, 0);
         if (ret < 0) {
@@ -3390,6 +3908,9 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
     cluster_offset &= s->cluster_offset_mask;
 
     ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len);
+    if (ret == 0) {
+        ret = qcow2_prealloc_file(bs, cluster_offset + out_len);
+    }
     qemu_co_mutex_unlock(&s->lock);
     if (ret < 0) {
         goto fail;
@@ -3542,6 +4063,7 @@ static int make_completely_empty(BlockDriverState *bs)
         goto fail;
     }
 
+    s->prealloc_end = 0;
     ret = bdrv_truncate(bs->file, (3 + l1_clusters) * s->cluster_size,
                         PREALLOC_MODE_OFF, &local_err);
     if (ret < 0) {
@@ -3798,6 +4320,10 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
             .has_corrupt        = true,
             .refcount_bits      = s->refcount_bits,
         };
+        if (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+            spec_info->u.qcow2.data->has_compression_type = true;
+            spec_info->u.qcow2.data->compression_type = s->compression_type;
+        }
     } else {
         /* if this assertion fails, this probably means a new version was
          * added without having it covered here */
@@ -4070,6 +4596,9 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
                              "not exceed 64 bits");
                 return -EINVAL;
             }
+        } else if (!strcmp(desc->name, BLOCK_OPT_COMPRESSION_TYPE)) {
+            error_report("Changing the compression type is not supported");
+            return -ENOTSUP;
         } else {
             /* if this point is reached, this probably means a new option was
              * added without having it covered here */
@@ -4303,6 +4832,11 @@ static QemuOptsList qcow2_create_opts = {
             .help = "Width of a reference count entry in bits",
             .def_value_str = "16"
         },
+        {
+            .name = BLOCK_OPT_COMPRESSION_TYPE,
+            .type = QEMU_OPT_STRING,
+            .help = "Compression method used for image cluster compression"
+        },
         { /* end of list */ }
     }
 };
@@ -4328,6 +4862,8 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_co_pwrite_zeroes  = qcow2_co_pwrite_zeroes,
     .bdrv_co_pdiscard       = qcow2_co_pdiscard,
+    .bdrv_co_copy_range_from = qcow2_co_copy_range_from,
+    .bdrv_co_copy_range_to  = qcow2_co_copy_range_to,
     .bdrv_truncate          = qcow2_truncate,
     .bdrv_co_pwritev_compressed = qcow2_co_pwritev_compressed,
     .bdrv_make_empty        = qcow2_make_empty,
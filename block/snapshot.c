@@ -195,6 +195,8 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
 
     if (drv->bdrv_snapshot_goto) {
         ret = drv->bdrv_snapshot_goto(bs, snapshot_id);
+        /* Even a failed revert may have changed the allocation */
+        bdrv_chain_cache_invalidate_all(bs);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Failed to load snapshot");
         }
@@ -221,6 +223,7 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
 
         ret = bdrv_snapshot_goto(file, snapshot_id, errp);
         open_ret = drv->bdrv_open(bs, options, bs->open_flags, &local_err);
+        bdrv_chain_cache_invalidate_all(bs);
         QDECREF(options);
         if (open_ret < 0) {
             bdrv_unref(file);
@@ -223,6 +223,10 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+#ifdef CONFIG_TCG
+    tb_profile_enabled = qemu_opt_get_bool(opts, "tb-profile", false);
+#endif
 }
 
 /* The current number of executed instructions is based on what we
@@ -1977,6 +1981,18 @@ void list_cpus(FILE *f, fprintf_function cpu_fprintf, const char *optarg)
 #endif
 }
 
+TBProfileInfoList *qmp_x_query_tb_profile(bool has_max, int64_t max,
+                                          Error **errp)
+{
+#ifdef CONFIG_TCG
+    if (tcg_enabled() && tb_profile_enabled) {
+        return tb_profile_query(has_max ? max : 20);
+    }
+#endif
+    error_setg(errp, "TB profiling requires -accel tcg,tb-profile=on");
+    return NULL;
+}
+
 CpuInfoList *qmp_query_cpus(Error **errp)
 {
     MachineState *ms = MACHINE(qdev_get_machine());
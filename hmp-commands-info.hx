@@ -279,6 +279,25 @@ STEXI
 Show dynamic compiler info.
 ETEXI
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-profile",
+        .args_type  = "disas:-d,max:i?",
+        .params     = "[-d] [max]",
+        .help       = "show the most executed translation blocks "
+                      "(-d: disassemble them)",
+        .cmd        = hmp_info_tb_profile,
+    },
+#endif
+
+STEXI
+@item info tb-profile [-d] [@var{max}]
+@findex info tb-profile
+Show the @var{max} (default 10) most executed translation blocks with
+their exit statistics.  With @code{-d}, also disassemble their guest code.
+Requires @code{-accel tcg,tb-profile=on}.
+ETEXI
+
 #if defined(CONFIG_TCG)
     {
         .name       = "opcount",
@@ -57,6 +57,7 @@
 #define BLOCK_OPT_NOCOW             "nocow"
 #define BLOCK_OPT_OBJECT_SIZE       "object_size"
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
+#define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -66,6 +67,8 @@ enum BdrvTrackedRequestType {
     BDRV_TRACKED_DISCARD,
 };
 
+typedef struct BdrvChainCache BdrvChainCache;
+
 typedef struct BdrvTrackedRequest {
     BlockDriverState *bs;
     int64_t offset;
@@ -201,6 +204,35 @@ struct BlockDriver {
     int coroutine_fn (*bdrv_co_pdiscard)(BlockDriverState *bs,
         int64_t offset, int bytes);
 
+    /*
+     * Copy @bytes from @src at @src_offset to @dst at @dst_offset without
+     * going through a buffer, if the drivers can do so.
+     *
+     * bdrv_co_copy_range_from() is called on the source node, with
+     * src->bs == bs.  It maps the source range to its own children and
+     * passes the request on, until a protocol driver calls
+     * bdrv_co_copy_range_to() to do the same on the destination side.
+     * bdrv_co_copy_range_to() is called on the destination node, with
+     * dst->bs == bs.
+     *
+     * Return -ENOTSUP if the range cannot be copied this way; callers then
+     * fall back to reading and writing the data.
+     */
+    int coroutine_fn (*bdrv_co_copy_range_from)(BlockDriverState *bs,
+                                                BdrvChild *src,
+                                                uint64_t src_offset,
+                                                BdrvChild *dst,
+                                                uint64_t dst_offset,
+                                                uint64_t bytes,
+                                                BdrvRequestFlags flags);
+    int coroutine_fn (*bdrv_co_copy_range_to)(BlockDriverState *bs,
+                                              BdrvChild *src,
+                                              uint64_t src_offset,
+                                              BdrvChild *dst,
+                                              uint64_t dst_offset,
+                                              uint64_t bytes,
+                                              BdrvRequestFlags flags);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -721,6 +753,9 @@ struct BlockDriverState {
 
     unsigned int write_gen;               /* Current data generation */
 
+    /* Which backing layer owns recently read ranges, see chain-cache.c */
+    BdrvChainCache *chain_cache;
+
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
@@ -970,6 +1005,10 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
  * @sync_mode: What parts of the disk image should be copied to the destination.
  * @sync_bitmap: The dirty bitmap if sync_mode is MIRROR_SYNC_MODE_INCREMENTAL.
+ * @compress: True to compress data written to @target.
+ * @max_workers: The maximum number of copy requests in flight at once.
+ * @max_chunk: The maximum size of a single copy request in bytes, or 0 for
+ *             one cluster.
  * @on_source_error: The action to take upon error reading from the source.
  * @on_target_error: The action to take upon error writing to the target.
  * @creation_flags: Flags that control the behavior of the Job lifetime.
@@ -985,7 +1024,8 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                             BlockDriverState *target, int64_t speed,
                             MirrorSyncMode sync_mode,
                             BdrvDirtyBitmap *sync_bitmap,
-                            bool compress,
+                            bool compress, int64_t max_workers,
+                            int64_t max_chunk,
                             BlockdevOnError on_source_error,
                             BlockdevOnError on_target_error,
                             int creation_flags,
@@ -1051,6 +1091,17 @@ bool blk_dev_is_medium_locked(BlockBackend *blk);
 
 void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
+void bdrv_chain_cache_enable(BlockDriverState *bs, unsigned cor_threshold);
+void bdrv_chain_cache_free(BlockDriverState *bs);
+void bdrv_chain_cache_invalidate(BlockDriverState *bs,
+                                 int64_t offset, int64_t bytes);
+void bdrv_chain_cache_invalidate_all(BlockDriverState *bs);
+int coroutine_fn bdrv_chain_cache_lookup(BlockDriverState *bs,
+                                         int64_t offset, int64_t bytes,
+                                         BdrvChild **owner);
+bool bdrv_chain_cache_is_hot(BlockDriverState *bs, int64_t offset,
+                             int64_t bytes);
+
 void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out);
 void bdrv_undo_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *in);
 
@@ -263,6 +263,7 @@ int walk_memory_regions(void *, walk_memory_regions_fn);
 int page_get_flags(target_ulong address);
 void page_set_flags(target_ulong start, target_ulong end, int flags);
 int page_check_range(target_ulong start, target_ulong len, int flags);
+target_ulong page_find_last_used(target_ulong start, target_ulong end);
 #endif
 
 CPUArchState *cpu_copy(CPUArchState *env);
@@ -58,6 +58,18 @@ void cpu_gen_init(void);
  */
 bool cpu_restore_state(CPUState *cpu, uintptr_t searched_pc);
 
+/**
+ * cpu_restore_state_exception:
+ * @cpu: the vCPU state is to be restore to
+ * @searched_pc: the host PC the exception was raised at
+ * @return: true if state was restored, false otherwise
+ *
+ * Like cpu_restore_state(), for use on the path that unwinds to the
+ * main loop with cpu->exception_index set.  Guest exceptions are
+ * accounted to the TB in the TB profile.
+ */
+bool cpu_restore_state_exception(CPUState *cpu, uintptr_t searched_pc);
+
 void QEMU_NORETURN cpu_loop_exit_noexc(CPUState *cpu);
 void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu,
@@ -305,6 +317,33 @@ static inline void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
 }
 #endif
 
+/**
+ * probe_access:
+ * @env: CPUArchState
+ * @addr: guest virtual address of the first byte of the range
+ * @size: length of the range in bytes; it must not cross a page boundary
+ * @access_type: type of the access that will be done on the range
+ * @mmu_idx: MMU index to use for lookup
+ * @retaddr: return address for unwinding if an exception is raised
+ *
+ * Look up the page containing @addr with a single TLB access, filling
+ * the TLB if needed.  If the access is not permitted, an exception is
+ * raised exactly as for a real guest access and this function does
+ * not return.  Otherwise, return a host pointer through which the
+ * whole range may be accessed directly, or NULL if the page must go
+ * through the slow path (I/O, dirty tracking, watchpoints).
+ *
+ * In user mode there is no TLB to fill: an inaccessible range also
+ * returns NULL, and the caller's slow path raises the guest fault.
+ *
+ * This lets helpers that operate on many bytes at once (string and
+ * block move instructions, vector loads and stores) do a single lookup
+ * per page instead of one per element.
+ */
+void *probe_access(CPUArchState *env, target_ulong addr, int size,
+                   MMUAccessType access_type, int mmu_idx,
+                   uintptr_t retaddr);
+
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
 /* Estimated block size for TB allocation.  */
@@ -329,6 +368,20 @@ struct tb_tc {
     size_t size;
 };
 
+/* Execution profile of a TB, maintained only when TB profiling is
+ * enabled with -accel tcg,tb-profile=on.  The counters are not atomic
+ * and may lose updates under MTTCG; they are meant for finding hot spots.
+ */
+struct tb_profile {
+    uint64_t exec_count;     /* times entered, updated by generated code */
+    uint32_t exit_nochain;   /* exits through an unpatched goto_tb */
+    uint32_t exit_requested; /* chain stopped here for an exit request */
+    uint32_t exit_restore;   /* guest exceptions unwound through this TB */
+    uint32_t helpers;        /* helper calls emitted for this TB */
+};
+
+extern bool tb_profile_enabled;
+
 struct TranslationBlock {
     target_ulong pc;   /* simulated PC corresponding to this block (EIP + CS base) */
     target_ulong cs_base; /* CS base for this block */
@@ -352,6 +405,8 @@ struct TranslationBlock {
 
     struct tb_tc tc;
 
+    struct tb_profile prof;
+
     /* original tb when cflags has CF_NOCACHE */
     struct TranslationBlock *orig_tb;
     /* first and second physical page containing code. The lower bit
@@ -402,6 +457,7 @@ static inline uint32_t curr_cflags(void)
 }
 
 void tb_remove(TranslationBlock *tb);
+struct TBProfileInfoList *tb_profile_query(int64_t max);
 void tb_flush(CPUState *cpu);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
@@ -0,0 +1,44 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_PERF_H
+#define EXEC_PERF_H
+
+#ifdef CONFIG_LINUX
+/* Start writing perf-<pid>.map.  */
+void perf_enable_perfmap(void);
+
+/* Start writing jit-<pid>.dump.  */
+void perf_enable_jitdump(void);
+
+/* Add information about the host code at @start, translated from the
+ * guest code at @guest_pc, to perf-<pid>.map and/or jit-<pid>.dump.
+ */
+void perf_report_code(uint64_t guest_pc, const void *start, size_t size);
+
+/* Stop writing perf-<pid>.map and/or jit-<pid>.dump.  */
+void perf_exit(void);
+#else
+static inline void perf_enable_perfmap(void)
+{
+}
+
+static inline void perf_enable_jitdump(void)
+{
+}
+
+static inline void perf_report_code(uint64_t guest_pc, const void *start,
+                                    size_t size)
+{
+}
+
+static inline void perf_exit(void)
+{
+}
+#endif
+
+#endif /* EXEC_PERF_H */
@@ -206,7 +206,7 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
 {
     abi_ulong addr;
     abi_ulong end_addr;
-    int prot;
+    target_ulong used;
     int looped = 0;
 
     if (size > reserved_va) {
@@ -218,26 +218,26 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
     if (end_addr > reserved_va) {
         end_addr = reserved_va;
     }
-    addr = end_addr - qemu_host_page_size;
+    addr = end_addr - size;
 
+    /* Slide the window [addr, end_addr) down below the highest page in
+       use inside it, until it is completely free.  */
     while (1) {
         if (addr > end_addr) {
             if (looped) {
                 return (abi_ulong)-1;
             }
             end_addr = reserved_va;
-            addr = end_addr - qemu_host_page_size;
+            addr = end_addr - size;
             looped = 1;
             continue;
         }
-        prot = page_get_flags(addr);
-        if (prot) {
-            end_addr = addr;
-        }
-        if (addr + size == end_addr) {
+        used = page_find_last_used(addr, end_addr);
+        if (used == (target_ulong)-1) {
             break;
         }
-        addr -= qemu_host_page_size;
+        end_addr = used & qemu_host_page_mask;
+        addr = end_addr - size;
     }
 
     if (start == mmap_next_start) {
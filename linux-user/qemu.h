@@ -129,6 +129,12 @@ typedef struct TaskState {
 
     struct emulated_sigtable sync_signal;
     struct emulated_sigtable sigtab[TARGET_NSIG];
+    /* Bit N is set if sigtab[N].pending is, so that
+     * process_pending_signals() need not scan the whole table.
+     * This is written from a signal handler so must only be modified
+     * with atomic_or() and atomic_and().
+     */
+    unsigned long sigtab_pending[BITS_TO_LONGS(TARGET_NSIG)];
     /* This thread's signal mask, as requested by the guest program.
      * The actual signal mask of this thread may differ:
      *  + we don't let SIGSEGV and SIGBUS be blocked while running guest code
@@ -662,6 +662,7 @@ static void host_signal_handler(int host_signum, siginfo_t *info,
     k = &ts->sigtab[sig - 1];
     k->info = tinfo;
     k->pending = sig;
+    atomic_or(&ts->sigtab_pending[BIT_WORD(sig - 1)], BIT_MASK(sig - 1));
     ts->signal_pending = 1;
 
     /* Block host signals until target signal handler entered. We
@@ -6889,7 +6890,7 @@ static void handle_pending_signal(CPUArchState *cpu_env, int sig,
 void process_pending_signals(CPUArchState *cpu_env)
 {
     CPUState *cpu = ENV_GET_CPU(cpu_env);
-    int sig;
+    int sig, i;
     TaskState *ts = cpu->opaque;
     sigset_t set;
     sigset_t *blocked_set;
@@ -6919,14 +6920,19 @@ void process_pending_signals(CPUArchState *cpu_env)
             handle_pending_signal(cpu_env, sig, &ts->sync_signal);
         }
 
-        for (sig = 1; sig <= TARGET_NSIG; sig++) {
-            blocked_set = ts->in_sigsuspend ?
-                &ts->sigsuspend_mask : &ts->signal_mask;
+        blocked_set = ts->in_sigsuspend ?
+            &ts->sigsuspend_mask : &ts->signal_mask;
 
-            if (ts->sigtab[sig - 1].pending &&
-                (!sigismember(blocked_set,
-                              target_to_host_signal_table[sig]))) {
-                handle_pending_signal(cpu_env, sig, &ts->sigtab[sig - 1]);
+        for (i = find_first_bit(ts->sigtab_pending, TARGET_NSIG);
+             i < TARGET_NSIG;
+             i = find_next_bit(ts->sigtab_pending, TARGET_NSIG, i + 1)) {
+            sig = i + 1;
+            if (!sigismember(blocked_set, target_to_host_signal_table[sig])) {
+                /* Host signals are blocked here, so the handler cannot
+                 * set this bit again before the entry is dequeued.
+                 */
+                atomic_and(&ts->sigtab_pending[BIT_WORD(i)], ~BIT_MASK(i));
+                handle_pending_signal(cpu_env, sig, &ts->sigtab[i]);
                 /* Restart scan from the beginning, as handle_pending_signal
                  * might have resulted in a new synchronous signal (eg SIGSEGV).
                  */
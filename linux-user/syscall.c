@@ -116,6 +116,7 @@ int __clone2(int (*fn)(void *), void *child_stack_base,
 #include "uname.h"
 
 #include "qemu.h"
+#include "exec/perf.h"
 
 #ifndef CLONE_IO
 #define CLONE_IO                0x80000000      /* Clone io context */
@@ -7792,6 +7793,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         _mcleanup();
 #endif
         gdb_exit(cpu_env, arg1);
+        perf_exit();
         _exit(arg1);
         ret = 0; /* avoid warning */
         break;
@@ -9869,6 +9871,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         _mcleanup();
 #endif
         gdb_exit(cpu_env, arg1);
+        perf_exit();
         ret = get_errno(exit_group(arg1));
         break;
 #endif
@@ -10135,6 +10138,9 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
             if (!(dirp = lock_user(VERIFY_WRITE, arg2, count, 0)))
                 goto efault;
             ret = get_errno(sys_getdents64(arg1, dirp, count));
+#ifdef BSWAP_NEEDED
+            /* The layout is the same for all targets, so the kernel's
+               output only needs converting for the byte order.  */
             if (!is_error(ret)) {
                 struct linux_dirent64 *de;
                 int len = ret;
@@ -10151,6 +10157,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
                     len -= reclen;
                 }
             }
+#endif
             unlock_user(dirp, arg2, ret);
         }
         break;
@@ -11694,7 +11701,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         struct timespec ts;
         ret = get_errno(clock_gettime(arg1, &ts));
         if (!is_error(ret)) {
-            host_to_target_timespec(arg2, &ts);
+            ret = host_to_target_timespec(arg2, &ts);
         }
         break;
     }
@@ -12079,6 +12086,16 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #endif
 
 #if defined(TARGET_NR_epoll_wait) || defined(TARGET_NR_epoll_pwait)
+/* True if the guest's epoll_event array can be handed to the host
+   kernel as is, e.g. for x86_64 on x86_64.  */
+#ifdef BSWAP_NEEDED
+#define EPOLL_EVENT_SAME_LAYOUT false
+#else
+#define EPOLL_EVENT_SAME_LAYOUT \
+    (sizeof(struct target_epoll_event) == sizeof(struct epoll_event) && \
+     offsetof(struct target_epoll_event, data) == \
+     offsetof(struct epoll_event, data))
+#endif
 #if defined(TARGET_NR_epoll_wait)
     case TARGET_NR_epoll_wait:
 #endif
@@ -12103,11 +12120,16 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
             goto efault;
         }
 
-        ep = g_try_new(struct epoll_event, maxevents);
-        if (!ep) {
-            unlock_user(target_ep, arg2, 0);
-            ret = -TARGET_ENOMEM;
-            break;
+        if (EPOLL_EVENT_SAME_LAYOUT) {
+            /* Let the kernel fill in the guest's array directly.  */
+            ep = (struct epoll_event *)target_ep;
+        } else {
+            ep = g_try_new(struct epoll_event, maxevents);
+            if (!ep) {
+                unlock_user(target_ep, arg2, 0);
+                ret = -TARGET_ENOMEM;
+                break;
+            }
         }
 
         switch (num) {
@@ -12151,16 +12173,20 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         }
         if (!is_error(ret)) {
             int i;
-            for (i = 0; i < ret; i++) {
-                target_ep[i].events = tswap32(ep[i].events);
-                target_ep[i].data.u64 = tswap64(ep[i].data.u64);
+            if (!EPOLL_EVENT_SAME_LAYOUT) {
+                for (i = 0; i < ret; i++) {
+                    target_ep[i].events = tswap32(ep[i].events);
+                    target_ep[i].data.u64 = tswap64(ep[i].data.u64);
+                }
             }
             unlock_user(target_ep, arg2,
                         ret * sizeof(struct target_epoll_event));
         } else {
             unlock_user(target_ep, arg2, 0);
         }
-        g_free(ep);
+        if (!EPOLL_EVENT_SAME_LAYOUT) {
+            g_free(ep);
+        }
         break;
     }
 #endif
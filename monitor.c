@@ -1127,6 +1127,41 @@ static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
 {
     dump_opcount_info((FILE *)mon, monitor_fprintf);
 }
+
+static void hmp_info_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    int max = qdict_get_try_int(qdict, "max", 10);
+    bool disas = qdict_get_try_bool(qdict, "disas", false);
+    TBProfileInfoList *list, *entry;
+    Error *err = NULL;
+
+    list = qmp_x_query_tb_profile(true, max, &err);
+    if (err) {
+        error_report_err(err);
+        return;
+    }
+
+    for (entry = list; entry; entry = entry->next) {
+        TBProfileInfo *info = entry->value;
+
+        monitor_printf(mon, "TB " TARGET_FMT_lx ": %" PRId64 " insns, "
+                       "%" PRId64 "/%" PRId64 " bytes guest/host, "
+                       "%" PRId64 " helpers\n",
+                       (target_ulong)info->pc, info->insns, info->size,
+                       info->host_size, info->helpers);
+        monitor_printf(mon, "  executed %" PRIu64 " times, exits: "
+                       "chained %" PRIu64 ", unchained %" PRIu64 ", "
+                       "requested %" PRIu64 ", exception %" PRIu64 "\n",
+                       info->exec_count, info->exit_chained,
+                       info->exit_nochain, info->exit_requested,
+                       info->exit_exception);
+        if (disas) {
+            monitor_disas(mon, mon_get_cpu(), info->pc, info->insns, 0);
+        }
+    }
+
+    qapi_free_TBProfileInfoList(list);
+}
 #endif
 
 static void hmp_info_history(Monitor *mon, const QDict *qdict)
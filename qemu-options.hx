@@ -125,9 +125,10 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,tb-profile=on|off]\n"
     "                select accelerator (kvm, xen, hax, hvf or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                tb-profile=on|off (enable per-TB execution profiling)", QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -141,6 +142,11 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item tb-profile=on|off
+Count how often each translation block is executed and how it is left
+(chained jump, return to the main loop, interrupt or exception).  The
+hottest blocks can be listed with the @code{info tb-profile} monitor
+command.  This slows down the generated code slightly.  The default is off.
 @end table
 ETEXI
 
@@ -764,6 +770,12 @@ The maximum size of the refcount block cache in bytes
 Clean unused entries in the L2 and refcount caches. The interval is in seconds.
 The default value is 0 and it disables this feature.
 
+@item prealloc-size
+When an allocating write extends the image file, grow the file by this many
+bytes more than needed, so that the following allocating writes do not have
+to extend it again. The file may end up to this much larger than necessary.
+The default value is 0 and it disables this feature.
+
 @item pass-discard-request
 Whether discard requests to the qcow2 device should be forwarded to the data
 source (on/off; default: on if discard=unmap is specified, off otherwise)
@@ -805,7 +817,8 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name]\n"
+    "       [,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -877,7 +890,8 @@ unsafe       │ on                off            on
 The default mode is @option{cache=writeback}.
 
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread
+based disk I/O, native Linux AIO and Linux io_uring.
 @item format=@var{format}
 Specify which disk @var{format} will be used rather than detecting
 the format.  Can be used to specify format=raw to avoid interpreting
@@ -3691,6 +3705,27 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        generate a /tmp/perf-${pid}.map file for perf\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -perfmap
+@findex -perfmap
+Generate a map file for Linux perf tools that will allow basic profiling
+information to be broken down into basic blocks.
+ETEXI
+
+DEF("jitdump", 0, QEMU_OPTION_jitdump, \
+    "-jitdump        generate a jit-${pid}.dump file for perf\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -jitdump
+@findex -jitdump
+Generate a dump file for Linux perf tools that maps basic blocks to symbol
+names, line numbers and JITted code.  Use it with @code{perf record -k 1}
+followed by @code{perf inject --jit}.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming tcp:[host]:port[,to=maxport][,ipv4][,ipv6]\n" \
     "-incoming rdma:host:port[,ipv4][,ipv6]\n" \
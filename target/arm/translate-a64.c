@@ -21,6 +21,7 @@
 #include "cpu.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "qemu/log.h"
 #include "arm_ldst.h"
 #include "translate.h"
@@ -557,6 +558,21 @@ static inline int fp_reg_hi_offset(DisasContext *s, int regno)
     return offsetof(CPUARMState, vfp.regs[regno * 2 + 1]);
 }
 
+/* Offset of the full 128 bit vector Qn, for use with the gvec expanders */
+static inline int vec_full_reg_offset(DisasContext *s, int regno)
+{
+    assert_fp_access_checked(s);
+    return offsetof(CPUARMState, vfp.regs[regno * 2]);
+}
+
+/* Size of the full vector register Qn; bytes of it above the operation
+ * size are zeroed by the gvec expanders.
+ */
+static inline int vec_full_reg_size(DisasContext *s)
+{
+    return 128 / 8;
+}
+
 /* Convenience accessors for reading and writing single and double
  * FP registers. Writing clears the upper parts of the associated
  * 128 bit vector register, as required by the architecture.
@@ -9058,12 +9074,40 @@ static void disas_simd_3same_logic(DisasContext *s, uint32_t insn)
     bool is_u = extract32(insn, 29, 1);
     bool is_q = extract32(insn, 30, 1);
     TCGv_i64 tcg_op1, tcg_op2, tcg_res[2];
+    void (*gvec_op)(unsigned, uint32_t, uint32_t, uint32_t,
+                    uint32_t, uint32_t) = NULL;
     int pass;
 
     if (!fp_access_check(s)) {
         return;
     }
 
+    if (!is_u) {
+        switch (size) {
+        case 0: /* AND */
+            gvec_op = tcg_gen_gvec_and;
+            break;
+        case 1: /* BIC */
+            gvec_op = tcg_gen_gvec_andc;
+            break;
+        case 2: /* ORR */
+            gvec_op = tcg_gen_gvec_or;
+            break;
+        case 3: /* ORN */
+            gvec_op = tcg_gen_gvec_orc;
+            break;
+        }
+    } else if (size == 0) { /* EOR */
+        gvec_op = tcg_gen_gvec_xor;
+    }
+
+    if (gvec_op) {
+        gvec_op(0, vec_full_reg_offset(s, rd), vec_full_reg_offset(s, rn),
+                vec_full_reg_offset(s, rm), is_q ? 16 : 8,
+                vec_full_reg_size(s));
+        return;
+    }
+
     tcg_op1 = tcg_temp_new_i64();
     tcg_op2 = tcg_temp_new_i64();
     tcg_res[0] = tcg_temp_new_i64();
@@ -9073,47 +9117,25 @@ static void disas_simd_3same_logic(DisasContext *s, uint32_t insn)
         read_vec_element(s, tcg_op1, rn, pass, MO_64);
         read_vec_element(s, tcg_op2, rm, pass, MO_64);
 
-        if (!is_u) {
-            switch (size) {
-            case 0: /* AND */
-                tcg_gen_and_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            case 1: /* BIC */
-                tcg_gen_andc_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            case 2: /* ORR */
-                tcg_gen_or_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            case 3: /* ORN */
-                tcg_gen_orc_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            }
-        } else {
-            if (size != 0) {
-                /* B* ops need res loaded to operate on */
-                read_vec_element(s, tcg_res[pass], rd, pass, MO_64);
-            }
+        /* B* ops need res loaded to operate on */
+        read_vec_element(s, tcg_res[pass], rd, pass, MO_64);
 
-            switch (size) {
-            case 0: /* EOR */
-                tcg_gen_xor_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            case 1: /* BSL bitwise select */
-                tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_op2);
-                tcg_gen_and_i64(tcg_op1, tcg_op1, tcg_res[pass]);
-                tcg_gen_xor_i64(tcg_res[pass], tcg_op2, tcg_op1);
-                break;
-            case 2: /* BIT, bitwise insert if true */
-                tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_res[pass]);
-                tcg_gen_and_i64(tcg_op1, tcg_op1, tcg_op2);
-                tcg_gen_xor_i64(tcg_res[pass], tcg_res[pass], tcg_op1);
-                break;
-            case 3: /* BIF, bitwise insert if false */
-                tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_res[pass]);
-                tcg_gen_andc_i64(tcg_op1, tcg_op1, tcg_op2);
-                tcg_gen_xor_i64(tcg_res[pass], tcg_res[pass], tcg_op1);
-                break;
-            }
+        switch (size) {
+        case 1: /* BSL bitwise select */
+            tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_op2);
+            tcg_gen_and_i64(tcg_op1, tcg_op1, tcg_res[pass]);
+            tcg_gen_xor_i64(tcg_res[pass], tcg_op2, tcg_op1);
+            break;
+        case 2: /* BIT, bitwise insert if true */
+            tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_res[pass]);
+            tcg_gen_and_i64(tcg_op1, tcg_op1, tcg_op2);
+            tcg_gen_xor_i64(tcg_res[pass], tcg_res[pass], tcg_op1);
+            break;
+        case 3: /* BIF, bitwise insert if false */
+            tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_res[pass]);
+            tcg_gen_andc_i64(tcg_op1, tcg_op1, tcg_op2);
+            tcg_gen_xor_i64(tcg_res[pass], tcg_res[pass], tcg_op1);
+            break;
         }
     }
 
@@ -9426,6 +9448,21 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
         return;
     }
 
+    if (opcode == 0x10) { /* ADD, SUB */
+        if (u) {
+            tcg_gen_gvec_sub(size, vec_full_reg_offset(s, rd),
+                             vec_full_reg_offset(s, rn),
+                             vec_full_reg_offset(s, rm),
+                             is_q ? 16 : 8, vec_full_reg_size(s));
+        } else {
+            tcg_gen_gvec_add(size, vec_full_reg_offset(s, rd),
+                             vec_full_reg_offset(s, rn),
+                             vec_full_reg_offset(s, rm),
+                             is_q ? 16 : 8, vec_full_reg_size(s));
+        }
+        return;
+    }
+
     if (size == 3) {
         assert(is_q);
         for (pass = 0; pass < 2; pass++) {
@@ -126,16 +126,16 @@ static void fast_memset(CPUS390XState *env, uint64_t dest, uint8_t byte,
     int mmu_idx = cpu_mmu_index(env, false);
 
     while (l > 0) {
-        void *p = tlb_vaddr_to_host(env, dest, MMU_DATA_STORE, mmu_idx);
+        uint32_t l_adj = adj_len_to_page(l, dest);
+        void *p = probe_access(env, dest, l_adj, MMU_DATA_STORE, mmu_idx, ra);
         if (p) {
             /* Access to the whole page in write mode granted.  */
-            uint32_t l_adj = adj_len_to_page(l, dest);
             memset(p, byte, l_adj);
             dest += l_adj;
             l -= l_adj;
         } else {
-            /* We failed to get access to the whole page. The next write
-               access will likely fill the QEMU TLB for the next iteration.  */
+            /* The page has to go through the slow path, e.g. for I/O
+               or dirty tracking.  */
             cpu_stb_data_ra(env, dest, byte, ra);
             dest++;
             l--;
@@ -158,17 +158,16 @@ static void fast_memmove_idx(CPUS390XState *env, uint64_t dest, uint64_t src,
     while (len > 0) {
         src = wrap_address(env, src);
         dest = wrap_address(env, dest);
-        src_p = tlb_vaddr_to_host(env, src, MMU_DATA_LOAD, src_idx);
-        dest_p = tlb_vaddr_to_host(env, dest, MMU_DATA_STORE, dest_idx);
+        len_adj = adj_len_to_page(adj_len_to_page(len, src), dest);
+        src_p = probe_access(env, src, len_adj, MMU_DATA_LOAD, src_idx, ra);
+        dest_p = probe_access(env, dest, len_adj, MMU_DATA_STORE, dest_idx, ra);
 
         if (src_p && dest_p) {
             /* Access to both whole pages granted.  */
-            len_adj = adj_len_to_page(adj_len_to_page(len, src), dest);
             memmove(dest_p, src_p, len_adj);
         } else {
-            /* We failed to get access to one or both whole pages. The next
-               read or write access will likely fill the QEMU TLB for the
-               next iteration.  */
+            /* One or both pages have to go through the slow path, e.g.
+               for I/O or dirty tracking.  */
             len_adj = 1;
             x = helper_ret_ldub_mmu(env, src, oi_src, ra);
             helper_ret_stb_mmu(env, dest, x, oi_dest, ra);
@@ -211,20 +210,20 @@ static void fast_memmove(CPUS390XState *env, uint64_t dest, uint64_t src,
     int mmu_idx = cpu_mmu_index(env, false);
 
     while (l > 0) {
-        void *src_p = tlb_vaddr_to_host(env, src, MMU_DATA_LOAD, mmu_idx);
-        void *dest_p = tlb_vaddr_to_host(env, dest, MMU_DATA_STORE, mmu_idx);
+        uint32_t l_adj = adj_len_to_page(adj_len_to_page(l, src), dest);
+        void *src_p = probe_access(env, src, l_adj, MMU_DATA_LOAD,
+                                   mmu_idx, ra);
+        void *dest_p = probe_access(env, dest, l_adj, MMU_DATA_STORE,
+                                    mmu_idx, ra);
         if (src_p && dest_p) {
             /* Access to both whole pages granted.  */
-            uint32_t l_adj = adj_len_to_page(l, src);
-            l_adj = adj_len_to_page(l_adj, dest);
             memmove(dest_p, src_p, l_adj);
             src += l_adj;
             dest += l_adj;
             l -= l_adj;
         } else {
-            /* We failed to get access to one or both whole pages. The next
-               read or write access will likely fill the QEMU TLB for the
-               next iteration.  */
+            /* One or both pages have to go through the slow path, e.g.
+               for I/O or dirty tracking.  */
             cpu_stb_data_ra(env, dest, cpu_ldub_data_ra(env, src, ra), ra);
             src++;
             dest++;
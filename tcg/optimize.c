@@ -599,6 +599,314 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
+/* Number of env slots whose contents are tracked by tcg_optimize_env.  */
+#define MAX_ENV_SLOTS  16
+
+/* A value known to be in an env slot: a load with opcode OPC from
+   env + OFS can be replaced by a move from VAL.  */
+struct env_val {
+    TCGOpcode opc;
+    intptr_t ofs;
+    TCGTemp *val;
+};
+
+/* A store to env + OFS whose data has not been read yet.  */
+struct env_store {
+    TCGOp *op;
+    intptr_t ofs;
+    int size;
+};
+
+struct env_state {
+    struct env_val vals[MAX_ENV_SLOTS];
+    struct env_store stores[MAX_ENV_SLOTS];
+    int nb_vals;
+    int nb_stores;
+};
+
+/* Return the size of the env access performed by OPC, or 0 if OPC is not
+   a host load or store.  */
+static int env_access_size(TCGOpcode opc)
+{
+    switch (opc) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static bool env_is_store(TCGOpcode opc)
+{
+    switch (opc) {
+    CASE_OP_32_64(st8):
+    CASE_OP_32_64(st16):
+    case INDEX_op_st_i32:
+    case INDEX_op_st32_i64:
+    case INDEX_op_st_i64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool env_overlap(intptr_t ofs1, int size1, intptr_t ofs2, int size2)
+{
+    return ofs1 < ofs2 + size2 && ofs2 < ofs1 + size1;
+}
+
+/* Return true if OFS/SIZE overlaps the memory slot of a global based on
+   ENV.  Such a global may be held in a host register and written back
+   at any point where globals are synced (helper calls, the end of the
+   block), so the slot cannot be tracked like other env fields.  */
+static bool env_is_global_slot(TCGContext *s, TCGTemp *env,
+                               intptr_t ofs, int size)
+{
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (!ts->fixed_reg && ts->mem_base == env
+            && env_overlap(ts->mem_offset,
+                           ts->type == TCG_TYPE_I32 ? 4 : 8, ofs, size)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Forget the values held in temps that satisfy PRED.  */
+static void env_forget_vals(struct env_state *es,
+                            bool (*pred)(TCGTemp *ts, void *opaque),
+                            void *opaque)
+{
+    int i, j;
+
+    for (i = j = 0; i < es->nb_vals; i++) {
+        if (!pred(es->vals[i].val, opaque)) {
+            es->vals[j++] = es->vals[i];
+        }
+    }
+    es->nb_vals = j;
+}
+
+static bool env_val_is(TCGTemp *ts, void *opaque)
+{
+    return ts == opaque;
+}
+
+static bool env_val_is_global(TCGTemp *ts, void *opaque)
+{
+    return ts->temp_global;
+}
+
+static bool env_val_is_temp(TCGTemp *ts, void *opaque)
+{
+    return !ts->temp_global && !ts->temp_local;
+}
+
+/* Forget the values of the env slots overlapping OFS/SIZE.  */
+static void env_forget_range(struct env_state *es, intptr_t ofs, int size)
+{
+    int i, j;
+
+    for (i = j = 0; i < es->nb_vals; i++) {
+        struct env_val *ev = &es->vals[i];
+        if (!env_overlap(ev->ofs, env_access_size(ev->opc), ofs, size)) {
+            es->vals[j++] = *ev;
+        }
+    }
+    es->nb_vals = j;
+}
+
+static void env_remember(struct env_state *es, TCGOpcode opc,
+                         intptr_t ofs, TCGTemp *val)
+{
+    if (es->nb_vals < MAX_ENV_SLOTS) {
+        struct env_val *ev = &es->vals[es->nb_vals++];
+        ev->opc = opc;
+        ev->ofs = ofs;
+        ev->val = val;
+    }
+}
+
+/* The stores overlapping OFS/SIZE are read, so they must stay.  */
+static void env_read_range(struct env_state *es, intptr_t ofs, int size)
+{
+    int i, j;
+
+    for (i = j = 0; i < es->nb_stores; i++) {
+        struct env_store *st = &es->stores[i];
+        if (!env_overlap(st->ofs, st->size, ofs, size)) {
+            es->stores[j++] = *st;
+        }
+    }
+    es->nb_stores = j;
+}
+
+/* Handle a store of SIZE bytes to env + OFS by OP: a previous store to
+   exactly the same slot that was never read is dead.  */
+static void env_store(TCGContext *s, struct env_state *es, TCGOp *op,
+                      intptr_t ofs, int size)
+{
+    int i;
+
+    for (i = 0; i < es->nb_stores; i++) {
+        struct env_store *st = &es->stores[i];
+        if (st->ofs == ofs && st->size == size) {
+            tcg_op_remove(s, st->op);
+            st->op = op;
+            return;
+        }
+    }
+    if (es->nb_stores < MAX_ENV_SLOTS) {
+        struct env_store *st = &es->stores[es->nb_stores++];
+        st->op = op;
+        st->ofs = ofs;
+        st->size = size;
+    }
+}
+
+/* Eliminate redundant loads from env, and stores to env that are
+   overwritten before being read, within an extended basic block.
+
+   Only accesses with cpu_env itself as the base are tracked, and not
+   those to the slot of a global, which the register allocator reads and
+   writes on its own.  Any other host store, as well as guest memory
+   accesses (which can run MMIO callbacks) and helper calls, may modify
+   env behind our back; helper calls, guest memory accesses and other
+   host loads may also read it, for example to restore the CPU state
+   after an exception.  Helpers flagged TCG_CALL_NO_SE cannot write
+   memory, so they only prevent the elimination of stores.  */
+static void tcg_optimize_env(TCGContext *s)
+{
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    struct env_state es = { .nb_vals = 0, .nb_stores = 0 };
+    TCGOp *op, *op_next;
+
+    QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        int size = env_access_size(opc);
+        int nb_oargs, i;
+
+        if (size) {
+            intptr_t ofs = op->args[2];
+
+            if (arg_temp(op->args[1]) != env) {
+                /* A pointer that may point into env.  */
+                if (env_is_store(opc)) {
+                    es.nb_vals = 0;
+                }
+                es.nb_stores = 0;
+                if (!env_is_store(opc)) {
+                    env_forget_vals(&es, env_val_is, arg_temp(op->args[0]));
+                }
+                continue;
+            }
+
+            if (env_is_global_slot(s, env, ofs, size)) {
+                /* Aliases a global: neither forward nor eliminate it.  */
+                env_forget_range(&es, ofs, size);
+                env_read_range(&es, ofs, size);
+                if (!env_is_store(opc)) {
+                    env_forget_vals(&es, env_val_is, arg_temp(op->args[0]));
+                }
+                continue;
+            }
+
+            if (env_is_store(opc)) {
+                TCGTemp *src = arg_temp(op->args[0]);
+
+                env_forget_range(&es, ofs, size);
+                if (opc == INDEX_op_st_i32) {
+                    env_remember(&es, INDEX_op_ld_i32, ofs, src);
+                } else if (opc == INDEX_op_st_i64) {
+                    env_remember(&es, INDEX_op_ld_i64, ofs, src);
+                }
+                env_store(s, &es, op, ofs, size);
+            } else {
+                TCGTemp *dst = arg_temp(op->args[0]);
+
+                env_read_range(&es, ofs, size);
+                for (i = 0; i < es.nb_vals; i++) {
+                    if (es.vals[i].opc == opc && es.vals[i].ofs == ofs) {
+                        break;
+                    }
+                }
+                if (i < es.nb_vals) {
+                    TCGTemp *val = es.vals[i].val;
+                    if (val == dst) {
+                        tcg_op_remove(s, op);
+                    } else {
+                        op->opc = op_to_mov(opc);
+                        op->args[1] = temp_arg(val);
+                        env_forget_vals(&es, env_val_is, dst);
+                    }
+                } else {
+                    env_forget_vals(&es, env_val_is, dst);
+                    env_remember(&es, opc, ofs, dst);
+                }
+            }
+            continue;
+        }
+
+        switch (opc) {
+        case INDEX_op_call:
+            nb_oargs = TCGOP_CALLO(op);
+            es.nb_stores = 0;
+            if (!(op->args[nb_oargs + TCGOP_CALLI(op) + 1]
+                  & TCG_CALL_NO_SIDE_EFFECTS)) {
+                es.nb_vals = 0;
+            } else if (!(op->args[nb_oargs + TCGOP_CALLI(op) + 1]
+                         & (TCG_CALL_NO_READ_GLOBALS
+                            | TCG_CALL_NO_WRITE_GLOBALS))) {
+                env_forget_vals(&es, env_val_is_global, NULL);
+            }
+            break;
+        case INDEX_op_qemu_ld_i32:
+        case INDEX_op_qemu_ld_i64:
+        case INDEX_op_qemu_st_i32:
+        case INDEX_op_qemu_st_i64:
+            nb_oargs = def->nb_oargs;
+            es.nb_vals = 0;
+            es.nb_stores = 0;
+            break;
+        default:
+            nb_oargs = def->nb_oargs;
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* The fall-through path continues the extended basic
+                   block, but ordinary temps die at the branch.  */
+                env_forget_vals(&es, env_val_is_temp, NULL);
+                es.nb_stores = 0;
+            } else if (def->flags & TCG_OPF_BB_END) {
+                es.nb_vals = 0;
+                es.nb_stores = 0;
+            }
+            break;
+        }
+
+        for (i = 0; i < nb_oargs; i++) {
+            env_forget_vals(&es, env_val_is, arg_temp(op->args[i]));
+        }
+    }
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
@@ -1498,4 +1806,6 @@ void tcg_optimize(TCGContext *s)
             prev_mb = op;
         }
     }
+
+    tcg_optimize_env(s);
 }
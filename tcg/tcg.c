@@ -1606,6 +1606,18 @@ static const char * const alignment_name[(MO_AMASK >> MO_ASHIFT) + 1] = {
     [MO_ALIGN_64 >> MO_ASHIFT] = "al64+",
 };
 
+/* Return the number of ops in the current translation, for statistics. */
+static int tcg_count_ops(TCGContext *s)
+{
+    TCGOp *op;
+    int n = 0;
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        n++;
+    }
+    return n;
+}
+
 void tcg_dump_ops(TCGContext *s)
 {
     char buf[128];
@@ -1972,6 +1984,25 @@ static void tcg_la_bb_end(TCGContext *s)
     }
 }
 
+/* liveness analysis: conditional branch: all temps are dead, globals
+   and local temps should be synced, but remain live on the fall-through
+   path. */
+static void tcg_la_bb_sync(TCGContext *s)
+{
+    int ng = s->nb_globals;
+    int nt = s->nb_temps;
+    int i;
+
+    for (i = 0; i < ng; ++i) {
+        s->temps[i].state |= TS_MEM;
+    }
+    for (i = ng; i < nt; ++i) {
+        s->temps[i].state = (s->temps[i].temp_local
+                             ? s->temps[i].state | TS_MEM
+                             : TS_DEAD);
+    }
+}
+
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -2170,7 +2201,9 @@ static void liveness_pass_1(TCGContext *s)
                 }
 
                 /* if end of basic block, update */
-                if (def->flags & TCG_OPF_BB_END) {
+                if (def->flags & TCG_OPF_COND_BRANCH) {
+                    tcg_la_bb_sync(s);
+                } else if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s);
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
@@ -2241,7 +2274,10 @@ static bool liveness_pass_2(TCGContext *s)
             nb_oargs = def->nb_oargs;
 
             /* Set flags similar to how calls require.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* Like reading globals: sync_globals */
+                call_flags = TCG_CALL_NO_WRITE_GLOBALS;
+            } else if (def->flags & TCG_OPF_BB_END) {
                 /* Like writing globals: save_globals */
                 call_flags = 0;
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -2314,6 +2350,18 @@ static bool liveness_pass_2(TCGContext *s)
             }
         }
 
+        /* The direct temporaries are ordinary temps and do not survive
+           a conditional branch.  The globals were synced above, so just
+           reload them on the fall-through path when needed.  */
+        if (def->flags & TCG_OPF_COND_BRANCH) {
+            for (i = 0; i < nb_globals; ++i) {
+                arg_ts = &s->temps[i];
+                if (arg_ts->state_ptr) {
+                    arg_ts->state = TS_DEAD;
+                }
+            }
+        }
+
         /* Outputs become available.  */
         for (i = 0; i < nb_oargs; i++) {
             arg_ts = arg_temp(op->args[i]);
@@ -2616,6 +2664,30 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
+/* at a conditional branch, we assume all temporaries are dead and
+   all globals and local temps are synced to their location.  Unlike
+   the end of a basic block, they may stay live in registers for the
+   fall-through path. */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        /* The liveness analysis already ensures that temps are dead
+           and that local temps are synced.  Keep tcg_debug_asserts
+           for safety. */
+        if (ts->temp_local) {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->mem_coherent);
+        } else {
+            tcg_debug_assert(ts->val_type == TEMP_VAL_DEAD);
+        }
+    }
+}
+
 /* at the end of a basic block, we assume all temporaries are dead and
    all globals are stored at their canonical location. */
 static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
@@ -2831,7 +2903,9 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -3136,6 +3210,9 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
     int i, num_insns;
     TCGOp *op;
+#ifdef DEBUG_DISAS
+    int nb_ops_before = 0;
+#endif
 
 #ifdef CONFIG_PROFILER
     {
@@ -3158,6 +3235,10 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef DEBUG_DISAS
+    if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP_OPT)
+                 && qemu_log_in_addr_range(tb->pc))) {
+        nb_ops_before = tcg_count_ops(s);
+    }
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP)
                  && qemu_log_in_addr_range(tb->pc))) {
         qemu_log_lock();
@@ -3211,6 +3292,8 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
         qemu_log_lock();
         qemu_log("OP after optimization and liveness analysis:\n");
         tcg_dump_ops(s);
+        qemu_log(" ops: %d before optimization, %d after\n",
+                 nb_ops_before, tcg_count_ops(s));
         qemu_log("\n");
         qemu_log_unlock();
     }
@@ -16,12 +16,26 @@
 #include "qemu/osdep.h"
 #include "libqtest.h"
 
+/*
+ * Before printing, store a long that straddles a (1k) page boundary in
+ * RAM and read it back, both as a whole and from the second page, so
+ * that the page-crossing paths of the softmmu helpers are exercised.
+ */
 static const uint8_t kernel_mcf5208[] = {
+    0x43, 0xf9, 0x40, 0x00, 0x1f, 0xfe,     /* lea 0x40001ffe,%a1 */
+    0x22, 0xbc, 0x12, 0x34, 0x56, 0x78,     /* move.l #0x12345678,(%a1) */
+    0x22, 0x11,                             /* move.l (%a1),%d1 */
+    0xb2, 0xbc, 0x12, 0x34, 0x56, 0x78,     /* cmp.l #0x12345678,%d1 */
+    0x66, 0x22,                             /* bne.s fail */
+    0x24, 0x29, 0x00, 0x02,                 /* move.l 2(%a1),%d2 */
+    0xb4, 0xbc, 0x56, 0x78, 0x00, 0x00,     /* cmp.l #0x56780000,%d2 */
+    0x66, 0x16,                             /* bne.s fail */
     0x41, 0xf9, 0xfc, 0x06, 0x00, 0x00,     /* lea 0xfc060000,%a0 */
     0x10, 0x3c, 0x00, 0x54,                 /* move.b #'T',%d0 */
     0x11, 0x7c, 0x00, 0x04, 0x00, 0x08,     /* move.b #4,8(%a0)     Enable TX */
     0x11, 0x40, 0x00, 0x0c,                 /* move.b %d0,12(%a0)   Print 'T' */
-    0x60, 0xfa                              /* bra.s  loop */
+    0x60, 0xfa,                             /* bra.s  loop */
+    0x60, 0xfe                              /* fail: bra.s fail */
 };
 
 typedef struct testdef {
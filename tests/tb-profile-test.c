@@ -0,0 +1,102 @@
+/*
+ * Check the exit counters reported by x-query-tb-profile
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2
+ * or later. See the COPYING file in the top-level directory.
+ *
+ * A small ColdFire kernel divides by zero ten times from the same
+ * translation block; the divide helper raises the exception through
+ * cpu_loop_exit_restore(), so that block must report ten exception
+ * exits while no other block reports any.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+
+#define LOOP_PC     0x40000022
+#define DONE_ADDR   0x40001000
+#define DONE_MAGIC  0x600d
+#define LOOP_COUNT  10
+
+static const uint8_t kernel_mcf5208[] = {
+    0x41, 0xf9, 0x40, 0x00, 0x04, 0x00,     /* lea 0x40000400,%a0 */
+    0x4e, 0x7b, 0x88, 0x01,                 /* movec %a0,%vbr */
+    0x43, 0xf9, 0x40, 0x00, 0x00, 0x38,     /* lea div0,%a1 */
+    0x21, 0x49, 0x00, 0x14,                 /* move.l %a1,20(%a0) */
+    0x4f, 0xf9, 0x40, 0x00, 0x20, 0x00,     /* lea 0x40002000,%sp */
+    0x74, 0x0a,                             /* moveq #10,%d2 */
+    0x72, 0x00,                             /* moveq #0,%d1 */
+    0x60, 0x00, 0x00, 0x02,                 /* bra.w loop */
+    0x80, 0xc1,                             /* loop: divu.w %d1,%d0 */
+    0x53, 0x82,                             /* subq.l #1,%d2 */
+    0x66, 0xfa,                             /* bne.s loop */
+    0x45, 0xf9, 0x40, 0x00, 0x10, 0x00,     /* lea 0x40001000,%a2 */
+    0x24, 0xbc, 0x00, 0x00, 0x60, 0x0d,     /* move.l #0x600d,(%a2) */
+    0x4a, 0xc8,                             /* halt */
+    0x60, 0xfe,                             /* bra.s . */
+    0x54, 0xaf, 0x00, 0x04,                 /* div0: addq.l #2,4(%sp) */
+    0x4e, 0x73,                             /* rte */
+};
+
+static void test_exit_exception(void)
+{
+    char codetmp[] = "/tmp/qtest-tb-profile-XXXXXX";
+    QDict *resp;
+    QList *list;
+    const QListEntry *e;
+    bool found = false;
+    ssize_t wlen;
+    int code_fd, i;
+
+    code_fd = mkstemp(codetmp);
+    g_assert(code_fd != -1);
+    wlen = write(code_fd, kernel_mcf5208, sizeof(kernel_mcf5208));
+    g_assert(wlen == sizeof(kernel_mcf5208));
+    close(code_fd);
+
+    global_qtest = qtest_startf("-kernel %s -M mcf5208evb "
+                                "-accel tcg,tb-profile=on", codetmp);
+    unlink(codetmp);
+
+    /* Wait for the kernel to leave the loop (max. 60 seconds) */
+    for (i = 0; i < 6000; i++) {
+        if (readl(DONE_ADDR) == DONE_MAGIC) {
+            break;
+        }
+        g_usleep(10000);
+    }
+    g_assert_cmphex(readl(DONE_ADDR), ==, DONE_MAGIC);
+
+    resp = qmp("{'execute': 'x-query-tb-profile',"
+               " 'arguments': { 'max': 1000 } }");
+    g_assert(qdict_haskey(resp, "return"));
+    list = qdict_get_qlist(resp, "return");
+
+    QLIST_FOREACH_ENTRY(list, e) {
+        QDict *tb = qobject_to_qdict(qlist_entry_obj(e));
+
+        if (qdict_get_int(tb, "pc") == LOOP_PC) {
+            g_assert_cmpint(qdict_get_int(tb, "exec-count"), ==, LOOP_COUNT);
+            g_assert_cmpint(qdict_get_int(tb, "exit-exception"), ==,
+                            LOOP_COUNT);
+            found = true;
+        } else {
+            g_assert_cmpint(qdict_get_int(tb, "exit-exception"), ==, 0);
+        }
+    }
+    g_assert(found);
+    QDECREF(resp);
+
+    qtest_quit(global_qtest);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("tb-profile/exit-exception", test_exit_exception);
+
+    return g_test_run();
+}
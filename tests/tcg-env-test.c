@@ -0,0 +1,83 @@
+/*
+ * Check the forwarding of CPU state fields by the TCG optimizer
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2
+ * or later. See the COPYING file in the top-level directory.
+ *
+ * The m68k front end reads and writes FPSR and USP with plain host
+ * loads and stores to env, so a single translation block of this
+ * ColdFire kernel checks that a known FPSR value is not forwarded past
+ * a helper that updates it, that an overwritten USP store is dropped
+ * in favour of the later one, and that a forwarded USP value does not
+ * follow the register it was copied from once that register changes.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define RESULT_ADDR 0x40001000
+#define DONE_MAGIC  0x600d
+
+static const uint8_t kernel_mcf5208[] = {
+    0x70, 0x00,                             /* moveq #0,%d0 */
+    0xf2, 0x00, 0x40, 0x00,                 /* fmove.l %d0,%fp0 */
+    0xf2, 0x00, 0x88, 0x00,                 /* fmove.l %d0,%fpsr */
+    0xf2, 0x03, 0x60, 0x00,                 /* fmove.l %fp0,%d3 */
+    0xf2, 0x01, 0xa8, 0x00,                 /* fmove.l %fpsr,%d1 */
+    0x20, 0x7c, 0x11, 0x11, 0x11, 0x11,     /* movea.l #0x11111111,%a0 */
+    0x4e, 0x60,                             /* move %a0,%usp */
+    0x20, 0x7c, 0x22, 0x22, 0x22, 0x22,     /* movea.l #0x22222222,%a0 */
+    0x4e, 0x60,                             /* move %a0,%usp */
+    0x4e, 0x69,                             /* move %usp,%a1 */
+    0x20, 0x7c, 0x33, 0x33, 0x33, 0x33,     /* movea.l #0x33333333,%a0 */
+    0x4e, 0x6a,                             /* move %usp,%a2 */
+    0x47, 0xf9, 0x40, 0x00, 0x10, 0x00,     /* lea 0x40001000,%a3 */
+    0x27, 0x41, 0x00, 0x04,                 /* move.l %d1,4(%a3) */
+    0x27, 0x49, 0x00, 0x08,                 /* move.l %a1,8(%a3) */
+    0x27, 0x4a, 0x00, 0x0c,                 /* move.l %a2,12(%a3) */
+    0x26, 0xbc, 0x00, 0x00, 0x60, 0x0d,     /* move.l #0x600d,(%a3) */
+    0x4a, 0xc8,                             /* halt */
+    0x60, 0xfe,                             /* bra.s . */
+};
+
+static void test_env_forwarding(void)
+{
+    char codetmp[] = "/tmp/qtest-tcg-env-XXXXXX";
+    ssize_t wlen;
+    int code_fd, i;
+
+    code_fd = mkstemp(codetmp);
+    g_assert(code_fd != -1);
+    wlen = write(code_fd, kernel_mcf5208, sizeof(kernel_mcf5208));
+    g_assert(wlen == sizeof(kernel_mcf5208));
+    close(code_fd);
+
+    global_qtest = qtest_startf("-kernel %s -M mcf5208evb,accel=tcg "
+                                "-cpu cfv4e", codetmp);
+    unlink(codetmp);
+
+    /* Wait for the kernel to store its results (max. 60 seconds) */
+    for (i = 0; i < 6000; i++) {
+        if (readl(RESULT_ADDR) == DONE_MAGIC) {
+            break;
+        }
+        g_usleep(10000);
+    }
+    g_assert_cmphex(readl(RESULT_ADDR), ==, DONE_MAGIC);
+
+    /* The fmove out of %fp0 (zero) sets the Z condition code */
+    g_assert_cmphex(readl(RESULT_ADDR + 4) & 0x0f000000, ==, 0x04000000);
+    g_assert_cmphex(readl(RESULT_ADDR + 8), ==, 0x22222222);
+    g_assert_cmphex(readl(RESULT_ADDR + 12), ==, 0x22222222);
+
+    qtest_quit(global_qtest);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("tcg-env/forwarding", test_env_forwarding);
+
+    return g_test_run();
+}
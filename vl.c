@@ -123,6 +123,7 @@ int main(int argc, char **argv)
 #include "qom/object_interfaces.h"
 #include "qapi-event.h"
 #include "exec/semihost.h"
+#include "exec/perf.h"
 #include "crypto/init.h"
 #include "sysemu/replay.h"
 #include "qapi/qmp/qerror.h"
@@ -334,6 +335,11 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "tb-profile",
+            .type = QEMU_OPT_BOOL,
+            .help = "Enable/disable per-TB execution profiling",
+        },
         { /* end of list */ }
     },
 };
@@ -3914,6 +3920,22 @@ int main(int argc, char **argv, char **envp)
                     exit(1);
                 }
                 break;
+            case QEMU_OPTION_perfmap:
+#ifdef CONFIG_TCG
+                perf_enable_perfmap();
+#else
+                error_report("TCG is disabled");
+                exit(1);
+#endif
+                break;
+            case QEMU_OPTION_jitdump:
+#ifdef CONFIG_TCG
+                perf_enable_jitdump();
+#else
+                error_report("TCG is disabled");
+                exit(1);
+#endif
+                break;
             case QEMU_OPTION_icount:
                 icount_opts = qemu_opts_parse_noisily(qemu_find_opts("icount"),
                                                       optarg, true);
@@ -4792,6 +4814,9 @@ int main(int argc, char **argv, char **envp)
     monitor_cleanup();
     qemu_chr_cleanup();
     user_creatable_cleanup();
+#ifdef CONFIG_TCG
+    perf_exit();
+#endif
     /* TODO: unref root container, check all devices are ok */
 
     return 0;